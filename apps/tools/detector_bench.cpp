@@ -0,0 +1,119 @@
+// Compare throughput and accuracy of the block detectors on a synthetic long-running cache workload
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "block_detector.h"
+#include "config.h"
+#include "utils.h"
+
+namespace {
+    struct BenchResult {
+        double ns_per_op{0};
+        uint64_t false_positive{0};
+        uint64_t negative{0};  // queries whose key was not in the cache
+        uint64_t false_negative{0};
+        uint64_t rebuild{0};
+        std::vector<double> fp_rate_by_phase;
+    };
+
+    /**
+     * Every op looks up one block the way CDCache::detecteBlockType does, a new block is inserted once it is cached.
+     * With probability `reuse` the block is one of the blocks currently cached, otherwise it is new.
+     * The cache holds `capacity` blocks in FIFO order and the evicted block is removed from the detector.
+     */
+    BenchResult run(const std::string &name, size_t capacity, size_t ops, double reuse, bool rebuild) {
+        globalEnv().c.block_detector = name;
+        globalEnv().c.dataset_block_size = 4096;
+        globalEnv().c.cache_size = capacity * 4096;
+        auto detector = Env::detectorInstance();
+
+        std::mt19937_64 gen(42);
+        std::uniform_real_distribution<double> coin(0, 1);
+        std::deque<uint64_t> fifo;
+        std::unordered_set<uint64_t> live;
+        BenchResult r;
+        uint64_t phase_fp = 0, phase_neg = 0;
+        std::chrono::nanoseconds detector_time{0};
+
+        for (size_t i = 0; i < ops; i++) {
+            uint64_t key = gen();
+            if (!fifo.empty() && coin(gen) < reuse) key = fifo[gen() % fifo.size()];
+            const bool truth = live.count(key) > 0;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            const bool detected = detector->query(key);
+            if (!truth) detector->insert(key);
+            detector_time += std::chrono::high_resolution_clock::now() - start;
+
+            if (!truth) {
+                ++r.negative;
+                ++phase_neg;
+                if (detected) {
+                    ++r.false_positive;
+                    ++phase_fp;
+                }
+                live.insert(key);
+                fifo.push_back(key);
+            } else if (!detected) {
+                ++r.false_negative;
+            }
+
+            if (fifo.size() > capacity) {
+                start = std::chrono::high_resolution_clock::now();
+                detector->remove(fifo.front());
+                detector_time += std::chrono::high_resolution_clock::now() - start;
+                live.erase(fifo.front());
+                fifo.pop_front();
+            }
+
+            if (rebuild && detector->overloaded()) {
+                detector->rebuild(std::vector<uint64_t>(fifo.begin(), fifo.end()));
+                ++r.rebuild;
+            }
+
+            if ((i + 1) % (ops / 10) == 0) {
+                r.fp_rate_by_phase.push_back(static_cast<double>(phase_fp) /
+                                             static_cast<double>(std::max<uint64_t>(1, phase_neg)));
+                phase_fp = phase_neg = 0;
+            }
+        }
+        r.ns_per_op = static_cast<double>(detector_time.count()) / static_cast<double>(ops);
+        delete detector;
+        return r;
+    }
+}  // namespace
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        printf("        Block detector benchmark\n\nBuild time %s %s\n\n", __DATE__, __TIME__);
+        printf("Use ./detector_bench [cache capacity in blocks] [ops] [reuse ratio=0.5] [fp rate=0.01]\n");
+        return 1;
+    }
+    const auto capacity = static_cast<size_t>(strtoull(argv[1], nullptr, 10));
+    const auto ops = std::max<size_t>(10, strtoull(argv[2], nullptr, 10));
+    const double reuse = argc > 3 ? strtod(argv[3], nullptr) : 0.5;
+    globalEnv().c.detector_fp_rate = argc > 4 ? strtod(argv[4], nullptr) : 0.01;
+    globalEnv().c.logger = stderr;
+
+    printf("capacity=%zu ops=%zu reuse=%.2lf target fp rate=%.4lf\n\n", capacity, ops, reuse,
+           globalEnv().c.detector_fp_rate);
+    printf("%-14s %-8s %10s %10s %10s %8s   fp rate per 10%% of the run\n", "detector", "rebuild", "ns/op", "fp rate",
+           "fn", "rebuilds");
+    for (const auto &name : {"bloom", "blocked_bloom", "cuckoo", "set"}) {
+        for (bool rebuild : {false, true}) {
+            auto r = run(name, capacity, ops, reuse, rebuild);
+            printf("%-14s %-8s %10.1lf %10.5lf %10lu %8lu  ", name, rebuild ? "yes" : "no", r.ns_per_op,
+                   static_cast<double>(r.false_positive) / static_cast<double>(std::max<uint64_t>(1, r.negative)),
+                   r.false_negative, r.rebuild);
+            for (auto v : r.fp_rate_by_phase) printf(" %.4lf", v);
+            printf("\n");
+        }
+    }
+    return 0;
+}
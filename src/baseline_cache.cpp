@@ -45,9 +45,11 @@ bool BaselineCache::write(const LogicalBlock &block, bool read_miss) {
         this->cache_.erase(ev);
     }
     // write and update LRU
-    this->cache_.insert(block.address());
-    this->policy_->insert(block.address());
-    this->policy_->promote(block.address());
+    if (this->cache_.insert(block.address()).second) {
+        this->policy_->admit(block.address());
+    } else {
+        this->policy_->promote(block.address());
+    }
     return true;
 }
 BaselineCache::~BaselineCache() { delete this->policy_; }
@@ -102,8 +104,7 @@ bool DedupCache::write(const LogicalBlock &block, bool read_miss) {
         this->lba_index_[block.address()] = block.raw_fp();
         this->fp_index_[block.raw_fp()] = random_address;
         this->cache_.insert(random_address);
-        this->policy_->insert(block.raw_fp());
-        this->policy_->promote(block.raw_fp());
+        this->policy_->admit(block.raw_fp());
         globalEnv().s.write_unique_blocks++;
         globalEnv().s.page_write += globalEnv().c.dataset_block_size / (globalEnv().c.page_granularity * 512);
         return true;
@@ -154,10 +155,17 @@ bool AdaptedBaselineCache::write(const LogicalBlock &block, bool read_miss) {
     // write
     auto random_address = allocate_cacheline_id();
     this->lba_index_[block.address()] = block.raw_fp();
-    this->fp_index_[block.raw_fp()].push_back(random_address);
+    auto &addresses = this->fp_index_[block.raw_fp()];
+    addresses.push_back(random_address);
     this->cache_.insert(random_address);
-    this->policy_->insert(block.raw_fp());
-    this->policy_->promote(block.raw_fp());
+    // another copy of a cached fingerprint is a hit on its policy entry (re-added if eviction dropped the key before
+    // all of its copies were gone)
+    if (addresses.size() == 1) {
+        this->policy_->admit(block.raw_fp());
+    } else {
+        this->policy_->insert(block.raw_fp());
+        this->policy_->promote(block.raw_fp());
+    }
     globalEnv().s.write_unique_blocks++;
     globalEnv().s.page_write += globalEnv().c.dataset_block_size / (globalEnv().c.page_granularity * 512);
     return true;
@@ -3,13 +3,45 @@
 #include "config.h"
 #include "utils.h"
 
-void BloomFilterDetector::insert(uint64_t value) { this->filter_.insert(value); }
-void BloomFilterDetector::remove(uint64_t value) { this->filter_.remove(value); }
-bool BloomFilterDetector::query(uint64_t value) { return this->filter_.query(value); }
+// CuckooFilterDetector
+void CuckooFilterDetector::insert(uint64_t value) {
+    if (!this->filter_.insert(value)) {
+        this->overflow_.insert(value);
+        globalEnv().s.detector_insert_failures++;
+    }
+}
+void CuckooFilterDetector::remove(uint64_t value) {
+    if (this->overflow_.erase(value) == 0) this->filter_.remove(value);
+}
+bool CuckooFilterDetector::query(uint64_t value) {
+    return this->filter_.query(value) || (!this->overflow_.empty() && this->overflow_.count(value));
+}
+bool CuckooFilterDetector::overloaded() const {
+    return this->filter_.full() || this->filter_.load() > CuckooFilter::MAX_LOAD;
+}
+
+// every key is inserted once, even if the filter already reports it, so each later remove deletes its own tag
+void CuckooFilterDetector::rebuild(const std::vector<uint64_t> &keys) {
+    while (keys.size() * 2 > this->capacity_) this->capacity_ *= 2;
+    while (true) {
+        this->filter_ = CuckooFilter(this->capacity_);
+        this->overflow_.clear();
+        size_t placed = 0;
+        while (placed < keys.size() && this->filter_.insert(keys[placed])) placed++;
+        if (placed == keys.size()) return;
+        this->capacity_ *= 2;
+    }
+}
+
+// two buckets of 4 slots are checked, each occupied slot matches a random tag with probability 2^-16
+double CuckooFilterDetector::estimatedFPRate() const {
+    return 8.0 * this->filter_.load() / static_cast<double>(1 << CuckooFilter::TAG_BITS);
+}
+
 // SetDetector
 // SetDetector::SetDetector(size_t value) {}
 
 void SetDetector::insert(uint64_t value) { this->set_.insert(value); }
 void SetDetector::remove(uint64_t value) { this->set_.erase(value); }
 bool SetDetector::query(uint64_t value) { return this->set_.count(value) >= threshold_; }
-void SetDetector::dumpInfo() {}
\ No newline at end of file
+void SetDetector::dumpInfo() {}
\ No newline at end of file
@@ -1,60 +1,105 @@
 #include "cd_cache.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdio>
+#include <fstream>
 #include <map>
 #include <set>
 
 #include "cacheline_index.h"
 #include "config.h"
 #include "main_compressor.h"
-
-addr_t allocate_cacheline_id() {
-    static addr_t id = 0;
-    ++id;
-    return id;
-}
+#include "xxhash.h"
+
+namespace {
+    // Leading record of the checkpoint written for a warm restart, followed by 64-bit words covered by `checksum`:
+    //   cachelines, next victim first: id, n, n pages
+    //   shared blocks: comp fp, raw fp, length, references, n, n pages
+    //   LBA index: lba, comp fp
+    //   compressed lengths of the blocks LBAs map to: comp fp, length
+    struct Superblock {
+        static constexpr uint64_t MAGIC = 0x31544e504b434443ULL;  // "CDCKPNT1"
+        uint64_t magic{MAGIC};
+        uint64_t page_size{0};
+        uint64_t device_size{0};
+        uint64_t cacheline_blocks{0};  // Config::data_block_buffer_size
+        uint64_t shared_layout{0};
+        uint64_t newest_cacheline{0};
+        uint64_t cachelines{0};
+        uint64_t shared_blocks{0};
+        uint64_t lbas{0};
+        uint64_t live_blocks{0};
+        uint64_t checksum{0};
+
+        // the device was written with the same geometry
+        [[nodiscard]] bool matches(const Superblock &other) const {
+            return this->magic == other.magic && this->page_size == other.page_size &&
+                   this->device_size == other.device_size && this->cacheline_blocks == other.cacheline_blocks &&
+                   this->shared_layout == other.shared_layout;
+        }
+    };
+}  // namespace
 
 CDCache::CDCache() {  // NOLINT
     // Init index
     this->fp_index_ = new SimpleFPIndex();
     this->lba_index_ = new SimpleLBAIndex();
-    this->detector_ = new BloomFilterDetector();
+    this->detector_ = Env::detectorInstance();
+    globalEnv().s.detector_capacity = this->detector_->capacity();
+    Assert(this->shared_layout_ || globalEnv().c.dedup_layout == "inline", "Unknown dedup layout %s",
+           globalEnv().c.dedup_layout.c_str());
+    Assert(globalEnv().c.compression_scope == "cacheline" || globalEnv().c.compression_scope == "block",
+           "Unknown compression scope %s", globalEnv().c.compression_scope.c_str());
     Assert(fp_index_ && lba_index_, "Can't not create index instances");
 }
 
 /**
- * Evict the cache line from the underlying SSD device and write the referenced data blocks back
- * @param id  id of cacheline that is to be evicted
- * @param data metadata of the cacheline
+ * Evict up to n cache lines from the underlying SSD device and write the referenced data blocks back
+ * @param n number of victims (Config::cache_policy.evict_batch), a cache line referencing several victims is
+ *          rewritten once for the whole batch
  */
 
-void CDCache::evictOne(cacheline_id_t id, const CachelineIndexData &data) {
-    std::map<cacheline_id_t, CachelineIndexData>
-        users;  // All cache lines (id->metadata) that reference the current cache line
-    // collect users
-    for (auto &used_by_cache_line_id : data.external_refs_) {
-        CachelineIndexData ref_data;
-        if (this->cacheline_index_.query(used_by_cache_line_id, ref_data, false)) {
-            users[used_by_cache_line_id] = ref_data;
-        }
-    }
+void CDCache::evict(size_t n) {
+    this->cacheline_index_.fetchOldestCachelines(n, this->evict_victims_);
+    this->removeVictims();
+}
 
-    // Collect the element data of the deleted cache line, which is the new metadata after being processed by the
-    // `removeCacheline` function.
-    std::pair<addr_t, CachelineIndexData> remove{id, data};
+// Remove `evict_victims_` from the device and the indexes
+void CDCache::removeVictims() {
+    auto &victims = this->evict_victims_;
+    // All cache lines (id->metadata handle) that reference one of the victims
+    auto &users = this->evict_users_;
+    this->cacheline_index_.collectRefs(victims, users);
+    auto is_victim = [&victims](addr_t id) {
+        return std::any_of(victims.begin(), victims.end(), [id](const auto &v) { return v.first == id; });
+    };
 
     std::map<fp_t, addr_t> deleted;
+    std::vector<fp_t> released;  // shared blocks whose last reference was dropped
 
-    LOGGER("[Evict] Users size is %zu, addresses size is %zu", users.size(), remove.second.allocation_page_.size());
-    // the users will be modified
+    LOGGER("[Evict] Victims size is %zu, users size is %zu", victims.size(), users.size());
+    // the users will be modified in place
     PROF_TIMER(evict_remove_cacheline, {
-        this->proxy_->removeCacheline(remove, users, deleted);  // 这个函数会更新users中的元数据，因为要重新修改指向
-        this->cacheline_index_.remove(id);
+        this->proxy_->removeCachelines(victims, users, deleted);  // 这个函数会直接更新users中的元数据，因为要重新修改指向
+        for (const auto &victim : victims) {
+            globalEnv().s.evict_stored_bytes += victim.second->data_bytes_;
+            globalEnv().s.evict_dead_bytes +=
+                victim.second->data_bytes_ - std::min(victim.second->live_bytes_, victim.second->data_bytes_);
+            for (auto fp : victim.second->shared_blocks_) {
+                if (this->proxy_->releaseSharedBlock(fp)) released.push_back(fp);
+            }
+            this->cacheline_index_.remove(victim.first);
+        }
     })
-    // update the index of the cachelines that refer to deleted cacheline
-    for (auto &ref : users) {
-        this->cacheline_index_.insert(ref.first, ref.second, false);
-    }
+
+    auto remove_block = [this](fp_t comp_fp, const FPIndexData &fp_data) {
+        this->fp_index_->remove(comp_fp);
+        this->releaseDetectorKey(fp_data.raw_fingerprint);
+        LOGGER("Remove Block [REAL] RFP = %zx, cfp =  %zx", fp_data.raw_fingerprint, comp_fp);
+        globalEnv().write("EVICT %lx", fp_data.raw_fingerprint);
+        globalEnv().s.block_evict_ctr++;
+    };
 
     PROF_TIMER(evict_update_index, {
         for (auto &ch : deleted) {
@@ -62,33 +107,42 @@ void CDCache::evictOne(cacheline_id_t id, const CachelineIndexData &data) {
             if (!this->fp_index_->query(ch.first, fp_data)) {
                 continue;
             }
-            if (ch.second == id) {
+            if (is_victim(ch.second)) {
                 // same id evicted realy
-                if (fp_data.cacheline_addr == id) {
-                    this->fp_index_->remove(ch.first);
-                    this->detector_->remove(fp_data.raw_fingerprint);
-                    LOGGER("Remove Block [REAL] RFP = %zx, cfp =  %zx", fp_data.raw_fingerprint, ch.first);
-                    globalEnv().write("EVICT %lx", fp_data.raw_fingerprint);
-                    globalEnv().s.block_evict_ctr++;
+                if (is_victim(fp_data.cacheline_addr)) {
+                    remove_block(ch.first, fp_data);
                     // LOGGER("  - really remove data_block cfp=%zu with rfp=%zu", ch.first, fp_data.raw_fingerprint);
                 } else {
                 }
             } else {
                 // moved to another cachelione
                 LOGGER("Remove [FAKE] RFP = %zx", fp_data.raw_fingerprint);
-                this->fp_index_->insert(ch.first, {ch.second});
+                this->fp_index_->insert(ch.first, {ch.second, fp_data.raw_fingerprint});
+                this->accountLive(ch.first, 1);
             }
         }
+        for (auto fp : released) {
+            FPIndexData fp_data{};
+            if (this->fp_index_->query(fp, fp_data)) remove_block(fp, fp_data);
+        }
+        // the users were rewritten with the blocks they took over
+        for (const auto &user : users) this->cacheline_index_.updateUtilization(user.first, *user.second);
     });
 
     globalEnv().s.time_evict_remove_cacheline += time_evict_remove_cacheline;
     globalEnv().s.time_evict_update_index += time_evict_update_index;
+    globalEnv().s.evict_batches++;
 }
 
 /**
  * @param read_miss If the current data block was written back due to a read miss
  */
 bool CDCache::write(const DataBlock &data_block, bool read_miss) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    return this->writeBlock(data_block, read_miss, lock);
+}
+
+bool CDCache::writeBlock(const DataBlock &data_block, bool read_miss, std::unique_lock<std::mutex> &lock) {
     if (!read_miss) {
         globalEnv().s.write_io_ctr++;
     } else {
@@ -98,25 +152,33 @@ bool CDCache::write(const DataBlock &data_block, bool read_miss) {
 
     this->data_block_buffer_.writeLogicalBlock(data_block);
     if (!this->data_block_buffer_.isFull()) return true;
-    return this->flushBuffer();  // flush when full
+    return this->flushBuffer(lock);  // flush when full
 }
 
-bool CDCache::flushBuffer() {
+bool CDCache::flushBuffer(std::unique_lock<std::mutex> &lock) {
     // Early eviction to prevent inconsistencies (complex reasons)
     auto &cfg = globalEnv().c;
+    bool stalled = false;
     PROF_TIMER(
         evict,
         // evict
         auto raw_cacheline_size = cfg.dataset_block_size * cfg.data_block_buffer_size;
         raw_cacheline_size += Cacheline::get_estimate_metadata_len();
-        auto estimated_block_need = (int)((double)(raw_cacheline_size)*1.5 / ((double)(cfg.page_granularity) * 512.0));
+        auto estimated_block_need = static_cast<size_t>(static_cast<double>(raw_cacheline_size) * 1.5 /
+                                                        (static_cast<double>(cfg.page_granularity) * 512.0));
         // Evict until enough space
-        size_t n = 0;
-        while (estimated_block_need > this->proxy_->free_blocks()) {
-            n++;
-            auto idx = this->cacheline_index_.fetchOldestCacheline();
-            this->evictOne(idx.first, idx.second);
+        stalled = estimated_block_need > this->proxy_->free_blocks();
+        if (this->reclaimer_.joinable()) {
+            this->waitForSpace(estimated_block_need, lock);
+        } else {
+            while (estimated_block_need > this->proxy_->free_blocks()) {
+                if (!this->clean()) this->evict(cfg.cache_policy.evict_batch);
+            }
         });
+    if (stalled) {
+        globalEnv().s.time_evict_stall += time_evict;
+        globalEnv().s.time_evict_stall_max = std::max<uint64_t>(globalEnv().s.time_evict_stall_max, time_evict);
+    }
 
     auto flush_data_blocks = this->data_block_buffer_.popAll();
     PROF_TIMER(detection, { this->detecteBlockType(flush_data_blocks); });
@@ -126,26 +188,54 @@ bool CDCache::flushBuffer() {
     // deduplication
     PROF_TIMER(deduplication, { this->dedupBlocks(flush_data_blocks); });
 
+    const auto cachelineId = ++this->newest_cacheline_;
     CachelineIndexData cachelineindexData;
+    cachelineindexData.id_ = cachelineId;
     // wirte cache line to SSD
     Assert(this->proxy_->writeDataBlocks(flush_data_blocks, cachelineindexData),
            "Can not write DataBlocks flush data_blocks to SSD");
     globalEnv().s.page_write += cachelineindexData.allocation_pages_.size();
 
-    auto cachelineId = allocate_cacheline_id();
+    // a cacheline holds one reference to each shared block it uses
+    auto &shared = cachelineindexData.shared_blocks_;
+    std::set<fp_t> stored;
+    for (auto &ch : flush_data_blocks) {
+        if (!ch.comp_duplicated() && stored.insert(ch.comp_fp()).second && this->lba_refs_.count(ch.comp_fp())) {
+            cachelineindexData.live_bytes_ += ch.comp_data().size();
+        }
+        if (ch.comp_duplicated() && ch.external_cacheline_addr() == SHARED_STORE_ID &&
+            std::find(shared.begin(), shared.end(), ch.comp_fp()) == shared.end()) {
+            this->proxy_->retainSharedBlock(ch.comp_fp());
+            shared.push_back(ch.comp_fp());
+        }
+    }
 
     this->cacheline_index_.insert(cachelineId, cachelineindexData, false);
+    this->cacheline_index_.updateUtilization(cachelineId, cachelineindexData);
 
     // updat FP index / Cacheline  index reference
     for (auto &ch : flush_data_blocks) {
         // 对于Unique data_block
         if (!ch.comp_duplicated()) {
+            FPIndexData old{};
+            if (!this->fp_index_->query(ch.comp_fp(), old)) this->holdDetectorKey(ch.raw_fp());
             this->fp_index_->insert(ch.comp_fp(), {cachelineId, ch.raw_fp()});  // NOLINT
-        } else {
-            this->cacheline_index_.addRefToCacheline(ch.external_cacheline_addr(), cachelineId, true);
+        } else if (ch.external_cacheline_addr() != SHARED_STORE_ID) {
+            this->cacheline_index_.addRefToCacheline(ch.external_cacheline_addr(), cachelineId, ch.comp_fp(),
+                                                     static_cast<uint32_t>(ch.comp_data().size()), true);
         }
     }
 
+    if (this->reclaimer_.joinable() && this->proxy_->free_blocks() < this->low_mark_) {
+        this->reclaim_cv_.notify_one();
+    }
+
+    if (this->detector_->overloaded()) {
+        PROF_TIMER(rebuild_detector, { this->rebuildDetector(); });
+        time_detection += time_rebuild_detector;
+    }
+    globalEnv().s.detector_estimated_fp_rate = this->detector_->estimatedFPRate();
+
     globalEnv().s.time_deduplication += time_deduplication;
     globalEnv().s.time_detection += time_detection;
     globalEnv().s.time_evict += time_evict;
@@ -153,14 +243,282 @@ bool CDCache::flushBuffer() {
     return true;
 }
 
-void CDCache::open(const std::string &name, size_t size) { this->proxy_ = new SSDProxy(name, size); }
+void CDCache::open(const std::string &name, size_t size) {
+    this->proxy_ = new SSDProxy(name, size);
+    if (globalEnv().c.warm_restart) {
+        // the relocation table and the segment summaries only live in memory
+        Assert(globalEnv().c.cache_device != "mem", "A warm restart needs a file or uring cache device");
+        Assert(globalEnv().c.device_layout == "page", "A warm restart needs the page device layout");
+        Assert(globalEnv().c.cache_policy.evict_repair == "eager", "A warm restart needs eager reference repair");
+        this->checkpoint_path_ = name + ".checkpoint";
+        PROF_TIMER(restart, {
+            if (!this->restore()) fprintf(stderr, "Warm restart: no usable checkpoint, cold start\n");
+        });
+        globalEnv().s.time_restart += time_restart;
+    }
+    const auto &p = globalEnv().c.cache_policy;
+    if (p.background_evict) {
+        const auto total = static_cast<double>(this->proxy_->total_blocks());
+        this->low_mark_ = static_cast<size_t>(total * p.low_watermark);
+        this->high_mark_ = std::max(this->low_mark_, static_cast<size_t>(total * p.high_watermark));
+        this->reclaimer_ = std::thread(&CDCache::reclaimLoop, this);
+    }
+}
+
+void CDCache::waitForSpace(size_t need, std::unique_lock<std::mutex> &lock) {
+    if (this->proxy_->free_blocks() >= need) return;
+    globalEnv().s.evict_stalls++;
+    this->waiting_need_ = need;
+    this->reclaim_cv_.notify_one();
+    this->space_cv_.wait(lock, [this, need] { return this->proxy_->free_blocks() >= need; });
+    this->waiting_need_ = 0;
+}
+
+void CDCache::reclaimLoop() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    auto target = [this] { return std::max(this->high_mark_, this->waiting_need_); };
+    while (true) {
+        this->reclaim_cv_.wait(lock, [this] {
+            return this->stop_ || this->proxy_->free_blocks() < this->low_mark_ ||
+                   this->proxy_->free_blocks() < this->waiting_need_;
+        });
+        if (this->stop_) return;
+        while (!this->stop_ && this->proxy_->free_blocks() < target()) {
+            PROF_TIMER(background_evict, {
+                if (!this->clean()) this->evict(globalEnv().c.cache_policy.evict_batch);
+            });
+            globalEnv().s.background_evict++;
+            globalEnv().s.time_background_evict += time_background_evict;
+            this->space_cv_.notify_all();
+            // one batch at a time, requests can be served in between
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+}
+
+void CDCache::checkpoint() {
+    this->proxy_->sync();
+    Superblock sb;
+    sb.page_size = 512 * globalEnv().c.page_granularity;
+    sb.device_size = this->proxy_->total_blocks() * sb.page_size;
+    sb.cacheline_blocks = globalEnv().c.data_block_buffer_size;
+    sb.shared_layout = this->shared_layout_;
+    sb.newest_cacheline = this->newest_cacheline_;
+
+    std::vector<uint64_t> body;
+    std::vector<cacheline_id_t> order;
+    this->cacheline_index_.evictionOrder(order);
+    for (auto id : order) {
+        const auto *data = this->cacheline_index_.find(id, false);
+        body.push_back(id);
+        body.push_back(data->allocation_pages_.size());
+        body.insert(body.end(), data->allocation_pages_.begin(), data->allocation_pages_.end());
+    }
+    sb.cachelines = order.size();
+    this->proxy_->forEachSharedBlock([&](fp_t fp, uint32_t len, uint32_t refs, const std::vector<addr_t> &pages) {
+        FPIndexData fp_data{};
+        Assert(this->fp_index_->query(fp, fp_data), "Shared block cfp=%zu is not in the fp index", fp);
+        body.insert(body.end(), {fp, fp_data.raw_fingerprint, len, refs, pages.size()});
+        body.insert(body.end(), pages.begin(), pages.end());
+        sb.shared_blocks++;
+    });
+    this->lba_index_->forEach([&](addr_t lba, fp_t fp) {
+        body.push_back(lba);
+        body.push_back(fp);
+        sb.lbas++;
+    });
+    for (const auto &kv : this->lba_refs_) {
+        body.push_back(kv.first);
+        body.push_back(kv.second.len);
+    }
+    sb.live_blocks = this->lba_refs_.size();
+    sb.checksum = XXH64(body.data(), body.size() * sizeof(uint64_t), 0);
+
+    std::ofstream out(this->checkpoint_path_, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&sb), sizeof(Superblock));
+    out.write(reinterpret_cast<const char *>(body.data()), static_cast<std::streamsize>(body.size() * sizeof(uint64_t)));
+    if (!out) ERROR("Can not write checkpoint %s", this->checkpoint_path_.c_str());
+}
+
+/**
+ * The checkpoint only names the pages of each cacheline, everything about the blocks comes from the cacheline
+ * metadata on the device: a block lives in the newest cacheline storing it unless it is in the shared store, and a
+ * reference to a block stored in another cacheline adds the referencing cacheline to its users. Cachelines are
+ * admitted to the replacement policy in their eviction order, their hit history is lost.
+ */
+bool CDCache::restore() {
+    std::ifstream in(this->checkpoint_path_, std::ios::binary);
+    if (!in) return false;
+    std::vector<char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    // the checkpoint describes the device as it was at shutdown, it is stale once the cache writes again
+    std::remove(this->checkpoint_path_.c_str());
+
+    Superblock expected;
+    expected.page_size = 512 * globalEnv().c.page_granularity;
+    expected.device_size = this->proxy_->total_blocks() * expected.page_size;
+    expected.cacheline_blocks = globalEnv().c.data_block_buffer_size;
+    expected.shared_layout = this->shared_layout_;
+    Superblock sb;
+    if (file.size() < sizeof(Superblock) || (file.size() - sizeof(Superblock)) % sizeof(uint64_t) != 0) return false;
+    memcpy(&sb, file.data(), sizeof(Superblock));
+    std::vector<uint64_t> body((file.size() - sizeof(Superblock)) / sizeof(uint64_t));
+    memcpy(body.data(), file.data() + sizeof(Superblock), body.size() * sizeof(uint64_t));
+    if (!sb.matches(expected) || sb.checksum != XXH64(body.data(), body.size() * sizeof(uint64_t), 0)) {
+        ERROR("Checkpoint %s does not match the cache device", this->checkpoint_path_.c_str());
+        return false;
+    }
+    size_t pos = 0;
+    auto next = [&body, &pos]() {
+        Assert(pos < body.size(), "Truncated checkpoint");
+        return body[pos++];
+    };
+
+    std::vector<CachelineIndexData> lines(sb.cachelines);
+    std::vector<const CachelineIndexData *> handles;
+    std::unordered_map<cacheline_id_t, size_t> slot;  // id -> index in lines
+    std::vector<addr_t> used;
+    for (size_t i = 0; i < lines.size(); i++) {
+        auto &data = lines[i];
+        data.id_ = next();
+        data.allocation_pages_.resize(next());
+        for (auto &addr : data.allocation_pages_) addr = next();
+        used.insert(used.end(), data.allocation_pages_.begin(), data.allocation_pages_.end());
+        handles.push_back(&data);
+        slot[data.id_] = i;
+    }
+    std::vector<Cacheline> metadata;
+    globalEnv().s.restart_page_read += this->proxy_->scanMetadata(handles, metadata);
+
+    std::unordered_map<fp_t, fp_t> shared;  // comp fp -> raw fp
+    for (size_t i = 0; i < sb.shared_blocks; i++) {
+        const auto fp = next();
+        const auto raw_fp = next();
+        const auto len = static_cast<uint32_t>(next());
+        const auto refs = static_cast<uint32_t>(next());
+        std::vector<addr_t> pages(next());
+        for (auto &addr : pages) addr = next();
+        this->proxy_->restoreSharedBlock(fp, len, refs, pages);
+        shared[fp] = raw_fp;
+    }
+    this->proxy_->restoreAllocation(used);
+    std::unordered_map<fp_t, uint32_t> lba_refs;
+    for (size_t i = 0; i < sb.lbas; i++) {
+        const auto lba = next();
+        const auto fp = next();
+        this->lba_index_->insert(lba, fp);
+        lba_refs[fp]++;
+    }
+    for (size_t i = 0; i < sb.live_blocks; i++) {
+        const auto fp = next();
+        const auto len = static_cast<uint32_t>(next());
+        this->lba_refs_[fp] = {lba_refs[fp], len};
+    }
+    Assert(pos == body.size(), "Checkpoint has %zu words left over", body.size() - pos);
+
+    // fp index
+    for (size_t i = 0; i < lines.size(); i++) {
+        for (const auto &info : metadata[i].data_blocks_info) {
+            if (info.type != 1 || shared.count(info.comp_fp)) continue;
+            FPIndexData fp_data{};
+            if (!this->fp_index_->query(info.comp_fp, fp_data) || fp_data.cacheline_addr < lines[i].id_) {
+                this->fp_index_->insert(info.comp_fp, {lines[i].id_, info.raw_fp});
+            }
+        }
+    }
+    for (const auto &kv : shared) this->fp_index_->insert(kv.first, {SHARED_STORE_ID, kv.second});
+    this->fp_index_->forEach([this](fp_t, const FPIndexData &data) { this->holdDetectorKey(data.raw_fingerprint); });
+
+    // compressed length of a block stored in a cacheline, 0 if it is not stored there
+    auto stored_len = [&metadata](size_t i, fp_t fp) -> uint32_t {
+        for (const auto &info : metadata[i].data_blocks_info) {
+            if (info.type == 1 && info.comp_fp == fp) return metadata[i].data_layout[info.pos_index].len;
+        }
+        return 0;
+    };
+    // users are added in the order the cachelines were written
+    std::vector<size_t> by_id(lines.size());
+    for (size_t i = 0; i < by_id.size(); i++) by_id[i] = i;
+    std::sort(by_id.begin(), by_id.end(), [&lines](size_t a, size_t b) { return lines[a].id_ < lines[b].id_; });
+    for (auto i : by_id) {
+        auto &data = lines[i];
+        data.data_bytes_ = metadata[i].header.data_blocks_data_len;
+        std::set<fp_t> stored;
+        for (const auto &info : metadata[i].data_blocks_info) {
+            const auto fp = info.comp_fp;
+            if ((info.type == 0 && info.external_address == SHARED_STORE_ID) || (info.type == 1 && shared.count(fp))) {
+                auto &held = data.shared_blocks_;
+                if (std::find(held.begin(), held.end(), fp) == held.end()) held.push_back(fp);
+            } else if (info.type == 0) {
+                auto owner = slot.find(info.external_address);
+                if (owner == slot.end()) continue;
+                const auto len = stored_len(owner->second, fp);
+                if (len == 0) continue;
+                auto &owner_data = lines[owner->second];
+                owner_data.external_refs_.insert(data.id_);
+                auto &block = owner_data.block_refs_[fp];
+                block.len = len;
+                if (block.users.empty() || block.users.back() != data.id_) block.users.push_back(data.id_);
+            } else if (info.type == 1 && stored.insert(fp).second) {
+                FPIndexData fp_data{};
+                auto live = this->lba_refs_.find(fp);
+                if (live != this->lba_refs_.end() && this->fp_index_->query(fp, fp_data) &&
+                    fp_data.cacheline_addr == data.id_) {
+                    data.live_bytes_ += live->second.len;
+                }
+            }
+        }
+    }
+    // insert() queues a cacheline behind the oldest one, so going newest first restores the LRU order
+    for (auto it = lines.rbegin(); it != lines.rend(); ++it) {
+        this->cacheline_index_.insert(it->id_, *it, false);
+        this->cacheline_index_.updateUtilization(it->id_, *it);
+    }
+    this->newest_cacheline_ = sb.newest_cacheline;
+
+    auto &s = globalEnv().s;
+    s.restart_cachelines = lines.size();
+    s.restart_blocks = this->fp_index_->size();
+    s.restart_shared_blocks = shared.size();
+    s.restart_lbas = sb.lbas;
+    fprintf(stderr, "Warm restart: %zu cachelines, %zu blocks, %zu LBAs restored (%zu metadata pages scanned)\n",
+            lines.size(), this->fp_index_->size(), sb.lbas, s.restart_page_read);
+    return true;
+}
+
+// Re-create the detector from the raw fingerprints of all blocks still stored in the cache
+void CDCache::rebuildDetector() {
+    std::vector<uint64_t> keys;
+    keys.reserve(this->detector_refs_.size());
+    for (const auto &kv : this->detector_refs_) keys.push_back(kv.first);
+    this->detector_->rebuild(keys);
+    globalEnv().s.detector_rebuild++;
+    globalEnv().s.detector_capacity = this->detector_->capacity();
+}
 
+void CDCache::holdDetectorKey(fp_t raw_fp) {
+    if (this->detector_refs_[raw_fp]++ == 0) this->detector_->insert(raw_fp);
+}
+
+void CDCache::releaseDetectorKey(fp_t raw_fp) {
+    auto it = this->detector_refs_.find(raw_fp);
+    if (it == this->detector_refs_.end()) return;
+    if (--it->second == 0) {
+        this->detector_refs_.erase(it);
+        this->detector_->remove(raw_fp);
+    }
+}
+
+// The keys of the stored blocks are inserted when their fp index entries are created (holdDetectorKey). Inserting on
+// a detector miss instead would skip the key of a false positive and later remove a key that was never inserted,
+// which clears bits shared with other keys of a filter based detector
 void CDCache::detecteBlockType(std::vector<DataBlock> &data_blocks) {
     for (auto &ch : data_blocks) {
         bool raw_duplicated = this->detector_->query(ch.raw_fp());
         ch.setRawDuplicated(raw_duplicated);
     }
-    for (auto &ch : data_blocks) this->detector_->insert(ch.raw_fp());  // 插入
 }
 
 // return the total size of all unique data blocks
@@ -172,9 +530,25 @@ size_t CDCache::dedupBlocks(std::vector<DataBlock> &data_blocks) {
         data.cacheline_addr = -1;
         data.raw_fingerprint = ch.raw_fp();
         auto comp_duplicated = this->fp_index_->query(ch.comp_fp(), data);
+        if (comp_duplicated && this->shared_layout_ && data.cacheline_addr != SHARED_STORE_ID) {
+            // second reference, move the block out of its cacheline into the shared block store
+            auto owner = this->cacheline_index_.find(data.cacheline_addr, false);
+            Assert(owner, "Can not find cfp=%zu 's cid=%zu in cacheline index", ch.comp_fp(), data.cacheline_addr);
+            this->accountLive(ch.comp_fp(), -1);
+            this->proxy_->shareBlock(ch.comp_fp(), *owner);
+            owner->shared_blocks_.push_back(ch.comp_fp());
+            data.cacheline_addr = SHARED_STORE_ID;
+            this->fp_index_->insert(ch.comp_fp(), data);
+        }
         ch.setCompDuplicated(comp_duplicated);
         ch.set_external_cacheline_addr(data.cacheline_addr);
         if (!comp_duplicated) {
+            // a unique block guessed as duplicated was compressed self-contained for nothing
+            if (ch.raw_duplicated()) {
+                globalEnv().s.detector_false_positive++;
+            } else {
+                globalEnv().s.detector_true_negative++;
+            }
             globalEnv().s.write_unique_blocks++;
             total_size += ch.comp_data().size();
         }
@@ -186,12 +560,129 @@ void CDCache::updateLBAIndex(std::vector<DataBlock> &data_blocks) {
     for (auto &ch : data_blocks) {
         globalEnv().s.compressed_data += ch.comp_data().size();
         globalEnv().s.raw_data += ch.raw_data().size();
+        fp_t old_fp;
+        if (this->lba_index_->query(ch.address(), old_fp)) {
+            if (old_fp == ch.comp_fp()) continue;
+            this->dropLbaRef(old_fp);  // overwritten
+        }
+        this->addLbaRef(ch.comp_fp(), static_cast<uint32_t>(ch.comp_data().size()));
         this->lba_index_->insert(ch.address(), ch.comp_fp());
     }
 }
 
+void CDCache::addLbaRef(fp_t comp_fp, uint32_t len) {
+    auto &block = this->lba_refs_[comp_fp];
+    block.len = len;
+    if (block.lba_refs++ == 0) this->accountLive(comp_fp, 1);
+}
+
+void CDCache::dropLbaRef(fp_t comp_fp) {
+    auto it = this->lba_refs_.find(comp_fp);
+    if (it == this->lba_refs_.end() || --it->second.lba_refs > 0) return;
+    this->accountLive(comp_fp, -1);
+    this->lba_refs_.erase(it);
+}
+
+void CDCache::accountLive(fp_t comp_fp, int sign) {
+    auto block = this->lba_refs_.find(comp_fp);
+    FPIndexData fp_data{};
+    if (block == this->lba_refs_.end() || !this->fp_index_->query(comp_fp, fp_data)) return;
+    auto data = this->cacheline_index_.find(fp_data.cacheline_addr, false);  // nullptr for the shared store
+    if (!data) return;
+    const size_t len = block->second.len;
+    data->live_bytes_ = sign > 0 ? data->live_bytes_ + len : data->live_bytes_ - std::min(data->live_bytes_, len);
+    if (sign < 0) this->cacheline_index_.updateUtilization(fp_data.cacheline_addr, *data);
+}
+
+/**
+ * LFS style cleaning: rewrite the cacheline with the best cost-benefit among those whose live fraction is below
+ * Config::cache_policy.gc_threshold, copying its live blocks forward and dropping the dead ones from the fp index.
+ * The cacheline keeps its id and its place in the replacement policy.
+ */
+bool CDCache::clean() {
+    if (globalEnv().c.device_layout == "log") return this->reclaimSegment();
+    const auto threshold = globalEnv().c.cache_policy.gc_threshold;
+    if (threshold <= 0) return false;
+    bool rescanned = false;
+    while (true) {
+        if (this->gc_candidates_.empty()) {
+            if (rescanned) return false;
+            this->cacheline_index_.cleaningCandidates(this->newest_cacheline_, GC_SCAN, this->gc_candidates_);
+            rescanned = true;
+            continue;
+        }
+        const auto id = this->gc_candidates_.back();
+        this->gc_candidates_.pop_back();
+        auto data = this->cacheline_index_.find(id, false);
+        // the candidate may have been evicted or written to since the scan
+        if (!data || static_cast<double>(data->live_bytes_) >= threshold * static_cast<double>(data->data_bytes_)) {
+            continue;
+        }
+        auto live = [this, id](fp_t fp) {
+            FPIndexData fp_data{};
+            return this->lba_refs_.count(fp) && this->fp_index_->query(fp, fp_data) && fp_data.cacheline_addr == id;
+        };
+        if (this->proxy_->compactCacheline(*data, live, this->gc_dropped_) == 0) continue;
+
+        for (auto fp : this->gc_dropped_) {
+            data->block_refs_.erase(fp);
+            FPIndexData fp_data{};
+            if (this->fp_index_->query(fp, fp_data) && fp_data.cacheline_addr == id) {
+                this->fp_index_->remove(fp);
+                this->releaseDetectorKey(fp_data.raw_fingerprint);
+                globalEnv().s.gc_blocks_dropped++;
+            }
+        }
+        data->external_refs_.clear();
+        for (const auto &kv : data->block_refs_) {
+            data->external_refs_.insert(kv.second.users.begin(), kv.second.users.end());
+        }
+        data->live_bytes_ = data->data_bytes_;
+        return true;
+    }
+}
+
+/**
+ * Log-structured device: free the segment chosen by SSDProxy::segmentToReclaim. Its live cachelines are moved to the
+ * open segment if they fill less than Config::segment_clean_threshold of it, and evicted otherwise.
+ */
+bool CDCache::reclaimSegment() {
+    double utilization = 0;
+    const auto segment = this->proxy_->segmentToReclaim(utilization);
+    if (segment == SIZE_MAX) return false;
+    auto find = [this](cacheline_id_t id) { return this->cacheline_index_.find(id, false); };
+    if (utilization < globalEnv().c.segment_clean_threshold) {
+        return this->proxy_->cleanSegment(segment, find);
+    }
+    this->proxy_->segmentCachelines(segment, find, this->evict_victims_);
+    if (this->evict_victims_.empty()) return false;
+    this->removeVictims();
+    globalEnv().s.segment_evicted++;
+    return true;
+}
+
+/**
+ * With Config::compression_scope = block a block decodes on its own, so only the metadata and the pages spanning it
+ * are read. Otherwise it may copy from the blocks flushed before it, which can live in other cachelines, and the whole
+ * cacheline is read without decoding the block. As nothing waits for that data, the read is left in flight and overlaps
+ * with the requests that follow.
+ */
+void CDCache::fetchBlock(fp_t comp_fp, const CachelineIndexData *data, LogicalBlock &block) {
+    auto &s = globalEnv().s;
+    const auto pages = s.device_read_pages;
+    if (globalEnv().c.compression_scope == "block") {
+        const auto comp = this->proxy_->readBlock(comp_fp, data);
+        block.setRawData(MainCompressor::decompressBlock(comp.toVector()));
+    } else {
+        this->proxy_->submitRead(comp_fp, data, this->read_buffer_);
+    }
+    s.read_device_blocks++;
+    s.read_page_read += s.device_read_pages - pages;
+}
+
 // read
 bool CDCache::read(LogicalBlock &block) {
+    std::unique_lock<std::mutex> lock(this->mutex_);
     globalEnv().s.read_io++;
     if (this->data_block_buffer_.tryReadLogicalDataBlock(block.address(), block)) {
         globalEnv().s.read_hit++;
@@ -201,7 +692,7 @@ bool CDCache::read(LogicalBlock &block) {
     fp_t comp_fp;
     if (!this->lba_index_->query(block.address(), comp_fp)) {
         globalEnv().s.read_lose_by_lba++;
-        this->write(block, true);
+        this->writeBlock(block, true, lock);
         block.setRawData({});
         return false;
     }
@@ -209,18 +700,22 @@ bool CDCache::read(LogicalBlock &block) {
     FPIndexData fp_index_data{};
     if (!this->fp_index_->query(comp_fp, fp_index_data)) {
         globalEnv().s.read_lose_by_fp++;
-        this->write(block, true);  // write through, write back cache
+        this->writeBlock(block, true, lock);  // write through, write back cache
         block.setRawData({});
         return false;
     }
 
     // LOGGER("cfp=%zu was stored in cacheline cid=%zu", comp_fp, fp_index_data.cacheline_addr);
-    CachelineIndexData cachelineIndexData;
-
-    Assert(this->cacheline_index_.query(fp_index_data.cacheline_addr, cachelineIndexData, true),
-           "[READ]Can not find cfp=%zu 's cid=%zu in  cacheline index\n", comp_fp, fp_index_data.cacheline_addr);
-    // decompress here
+    if (fp_index_data.cacheline_addr == SHARED_STORE_ID) {
+        globalEnv().s.read_hit++;
+        if (globalEnv().c.read_from_device) this->fetchBlock(comp_fp, nullptr, block);
+        return true;
+    }
+    const auto *data = this->cacheline_index_.find(fp_index_data.cacheline_addr, true);
+    Assert(data != nullptr, "[READ]Can not find cfp=%zu 's cid=%zu in  cacheline index\n", comp_fp,
+           fp_index_data.cacheline_addr);
     globalEnv().s.read_hit++;
+    if (globalEnv().c.read_from_device) this->fetchBlock(comp_fp, data, block);
     return true;
 
     // Cacheline cacheline;
@@ -287,8 +782,19 @@ bool CDCache::read(LogicalBlock &block) {
 }
 
 CDCache::~CDCache() {
+    if (this->reclaimer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(this->mutex_);
+            this->stop_ = true;
+        }
+        this->reclaim_cv_.notify_one();
+        this->reclaimer_.join();
+    }
+    // blocks still in the data block buffer are not part of any cacheline and are lost
+    if (!this->checkpoint_path_.empty()) this->checkpoint();
     delete this->proxy_;
     delete this->fp_index_;
     delete this->lba_index_;
+    delete this->detector_;
     // delete this->pv_;
 }
@@ -120,7 +120,7 @@ namespace {
             auto pos = cur;
             pos_t ref = -1;
             pos_t start = cur;
-            const auto limit = cs.dup ? cs.begin : cur - 32767;  // 32K
+            const auto limit = cs.dup || cs.isolated ? cs.begin : cur - 32767;  // 32K
             const auto len = _getOneMatch(data, cs, cur, ref, start, limit);
             // handle match result
             if (len == -1) {  // literal
@@ -147,11 +147,13 @@ namespace {
     void buildDataBlockSlice(const std::vector<DataBlock> &data_blocks, std::vector<DataBlockSlice> &data_block_slice,
                              std::vector<byte_t> &data) {
         int acc = 0;
+        const bool isolated = globalEnv().c.compression_scope == "block";
         for (auto &ch : data_blocks) {
             DataBlockSlice m;
             m.begin = acc;
             m.end = acc + ch.raw_data().size() - 1;
             m.dup = ch.raw_duplicated();
+            m.isolated = isolated;
             m.pairs.resize(ch.raw_data().size());
             data_block_slice.push_back(m);
             data.insert(data.end(), ch.raw_data().begin(), ch.raw_data().end());
@@ -30,6 +30,11 @@ std::vector<LZ77Pair> MainCompressor::lz77CompressByteArray(const std::vector<by
     return slice[0].pairs;
 }
 
+std::vector<byte_t> MainCompressor::decompressBlock(const std::vector<byte_t> &compData) {
+    Assert(globalEnv().c.compression_method == "lz77", "Wrong compression %s", globalEnv().c.compression_method.c_str());
+    return lz77DecompressByteArray(decodeLz77(compData));
+}
+
 std::vector<byte_t> MainCompressor::lz77DecompressByteArray(const std::vector<LZ77Pair> &pairs) {
     std::vector<byte_t> bytes;
     for (auto &p : pairs) {
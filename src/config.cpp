@@ -1,11 +1,13 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "nlohmann/json.hpp"
 #include "utils.h"
@@ -26,10 +28,48 @@ bool Config::initFromFile(const std::string &config_name) {
         auto random_name = std::to_string(get_timestamp());
         this->primary_name = j.value("primary_name", random_name + ".primary.dev");
         this->cache_name = j.value("cache_name", random_name + ".primary.dev");
+        this->cache_device = j.value("cache_device", "mem");
+        this->io_queue_depth = j.value("io_queue_depth", 32);
+        this->use_direct_io = j.value("use_direct_io", false);
+        this->warm_restart = j.value("warm_restart", false);
         this->primary_size = j.value("primary_size", 128 * 1024);
         this->compression_method = j.value("compression_method", "lz77");
+        this->compression_scope = j.value("compression_scope", "cacheline");
+        this->read_from_device = j.value("read_from_device", false);
+        this->block_detector = j.value("block_detector", "bloom");
+        this->detector_fp_rate = j.value("detector_fp_rate", 0.01);
+        this->dedup_layout = j.value("dedup_layout", "inline");
+        this->page_allocator = j.value("page_allocator", "stacked");
+        this->device_layout = j.value("device_layout", "page");
+        this->segment_size = j.value("segment_size", 4 << 20);
+        this->segment_clean_threshold = j.value("segment_clean_threshold", 0.3);
+        if (this->segment_clean_threshold < 0 || this->segment_clean_threshold >= 1) {
+            ERROR("Invalid segment clean threshold, expect 0 <= threshold < 1");
+            return false;
+        }
         this->cache_policy.policy = j.value("cache_policy", "lru");
-        this->cache_policy.policy = j.value("promote_policy", "no");
+        this->cache_policy.promote_policy = j.value("promote_policy", "no");
+        this->cache_policy.evict_window = j.value("evict_window", 5);
+        this->cache_policy.evict_batch = j.value("evict_batch", 1);
+        this->cache_policy.evict_repair = j.value("evict_repair", "eager");
+        this->cache_policy.evict_mode = j.value("evict_mode", "refs");
+        this->cache_policy.weight_age = j.value("evict_weight_age", 1.0);
+        this->cache_policy.weight_migration = j.value("evict_weight_migration", 1.0);
+        this->cache_policy.weight_live = j.value("evict_weight_live", 1.0);
+        this->cache_policy.weight_refs = j.value("evict_weight_refs", 1.0);
+        this->cache_policy.gc_threshold = j.value("gc_threshold", 0.0);
+        if (this->cache_policy.gc_threshold < 0 || this->cache_policy.gc_threshold >= 1) {
+            ERROR("Invalid gc threshold, expect 0 <= threshold < 1");
+            return false;
+        }
+        this->cache_policy.background_evict = j.value("background_evict", false);
+        this->cache_policy.low_watermark = j.value("evict_low_watermark", 0.05);
+        this->cache_policy.high_watermark = j.value("evict_high_watermark", 0.1);
+        if (this->cache_policy.low_watermark < 0 || this->cache_policy.high_watermark >= 1 ||
+            this->cache_policy.low_watermark > this->cache_policy.high_watermark) {
+            ERROR("Invalid eviction watermarks, expect 0 <= low <= high < 1");
+            return false;
+        }
         GET_VALUE(std::string, dataset_trace_path);
         GET_VALUE(std::string, dataset_data_path);
         GET_VALUE(size_t, dataset_block_size);
@@ -60,13 +100,33 @@ void Config::dump(FILE *fp) const {
     fprintf(fp, "Primary name:          %s\n", this->primary_name.c_str());
     fprintf(fp, "Primary size:          %zu KBytes\n", this->primary_size);
     fprintf(fp, "Cache name:            %s\n", this->cache_name.c_str());
+    fprintf(fp, "Cache device:          %s (queue depth %u%s%s)\n", this->cache_device.c_str(), this->io_queue_depth,
+            this->use_direct_io ? ", direct I/O" : "", this->warm_restart ? ", warm restart" : "");
     fprintf(fp, "Cache size:            %zu Bytes (%.2lf MiB)\n", this->cache_size,
             static_cast<double>(this->cache_size) / (1024.0 * 1024.0));
     fprintf(fp, "DataBlock buffer size:     %zu\n", this->data_block_buffer_size);
     fprintf(fp, "Cache policy:          %s\n", this->cache_policy.policy.c_str());
     fprintf(fp, "promote policy:         %s\n", this->cache_policy.promote_policy.c_str());
+    fprintf(fp, "Evict window:          %zu\n", this->cache_policy.evict_window);
+    fprintf(fp, "Evict batch:           %zu\n", this->cache_policy.evict_batch);
+    fprintf(fp, "Evict repair:          %s\n", this->cache_policy.evict_repair.c_str());
+    fprintf(fp, "Evict mode:            %s (weights age %.2lf, migration %.2lf, live %.2lf, refs %.2lf)\n",
+            this->cache_policy.evict_mode.c_str(), this->cache_policy.weight_age, this->cache_policy.weight_migration,
+            this->cache_policy.weight_live, this->cache_policy.weight_refs);
+    fprintf(fp, "GC threshold:          %.2lf\n", this->cache_policy.gc_threshold);
+    fprintf(fp, "Background evict:      %s (watermarks %.2lf / %.2lf)\n",
+            this->cache_policy.background_evict ? "yes" : "no", this->cache_policy.low_watermark,
+            this->cache_policy.high_watermark);
     fprintf(fp, "Cache type:            %s\n", this->cache_type.c_str());
-    fprintf(fp, "Compression method:    %s\n", this->compression_method.c_str());
+    fprintf(fp, "Compression method:    %s (scope %s)\n", this->compression_method.c_str(),
+            this->compression_scope.c_str());
+    fprintf(fp, "Read from device:      %s\n", this->read_from_device ? "yes" : "no");
+    fprintf(fp, "Block detector:        %s (target fp rate %.4lf)\n", this->block_detector.c_str(),
+            this->detector_fp_rate);
+    fprintf(fp, "Dedup layout:          %s\n", this->dedup_layout.c_str());
+    fprintf(fp, "Page allocator:        %s\n", this->page_allocator.c_str());
+    fprintf(fp, "Device layout:         %s (segment %zu Bytes, clean threshold %.2lf)\n", this->device_layout.c_str(),
+            this->segment_size, this->segment_clean_threshold);
     printf("---------------------------------------------------\n");
     fprintf(fp, "Dataset Block size:    %zu Byte\n", this->dataset_block_size);
     fprintf(fp, "Dataset Trace path:    %s\n", this->dataset_trace_path.c_str());
@@ -82,9 +142,34 @@ nlohmann::json Config::toJson() {
     j["primary_name"] = this->primary_name;
     j["primary_size"] = this->primary_size;
     j["cache_name"] = this->cache_name;
+    j["cache_device"] = this->cache_device;
+    j["io_queue_depth"] = this->io_queue_depth;
+    j["use_direct_io"] = this->use_direct_io;
+    j["warm_restart"] = this->warm_restart;
     j["cache_size"] = this->cache_size;
     j["data_block_buffer_size"] = this->data_block_buffer_size;
     j["compression_method"] = this->compression_method;
+    j["compression_scope"] = this->compression_scope;
+    j["read_from_device"] = this->read_from_device;
+    j["evict_window"] = this->cache_policy.evict_window;
+    j["evict_batch"] = this->cache_policy.evict_batch;
+    j["evict_repair"] = this->cache_policy.evict_repair;
+    j["evict_mode"] = this->cache_policy.evict_mode;
+    j["evict_weight_age"] = this->cache_policy.weight_age;
+    j["evict_weight_migration"] = this->cache_policy.weight_migration;
+    j["evict_weight_live"] = this->cache_policy.weight_live;
+    j["evict_weight_refs"] = this->cache_policy.weight_refs;
+    j["gc_threshold"] = this->cache_policy.gc_threshold;
+    j["background_evict"] = this->cache_policy.background_evict;
+    j["evict_low_watermark"] = this->cache_policy.low_watermark;
+    j["evict_high_watermark"] = this->cache_policy.high_watermark;
+    j["block_detector"] = this->block_detector;
+    j["detector_fp_rate"] = this->detector_fp_rate;
+    j["dedup_layout"] = this->dedup_layout;
+    j["page_allocator"] = this->page_allocator;
+    j["device_layout"] = this->device_layout;
+    j["segment_size"] = this->segment_size;
+    j["segment_clean_threshold"] = this->segment_clean_threshold;
     j["data_block_size"] = this->dataset_block_size;
     j["trace_path"] = this->dataset_trace_path;
     j["data_path"] = this->dataset_data_path;
@@ -92,6 +177,24 @@ nlohmann::json Config::toJson() {
 }
 
 bool Env::init(const std::string &path) { return this->c.initFromFile(path); }
+
+AbstractBlockDetector *Env::detectorInstance() {
+    const auto &name = globalEnv().c.block_detector;
+    // sized for the number of blocks the cache can hold without compression, grows when needed
+    const auto capacity = globalEnv().c.cache_size / globalEnv().c.dataset_block_size;
+    const auto fp_rate = globalEnv().c.detector_fp_rate;
+    if (name == "bloom") {
+        return new BloomFilterDetector(capacity, fp_rate);
+    } else if (name == "blocked_bloom") {
+        return new BlockedBloomFilterDetector(capacity, fp_rate);
+    } else if (name == "cuckoo") {
+        return new CuckooFilterDetector(capacity);
+    } else if (name == "set") {
+        return new SetDetector();
+    } else {
+        throw std::runtime_error("Unknown block detector type: " + name);
+    }
+}
 void Env::startEvaluation() { start_time = get_timestamp(); }
 void Env::finishEvaluation() {
     end_time = get_timestamp();
@@ -116,16 +219,90 @@ nlohmann::json Stat::toJson() {
     // for cdcache
     j["read_lose_by_lba"] = read_lose_by_lba;
     j["read_lose_by_fp"] = read_lose_by_fp;
+    j["read_device"]["blocks"] = read_device_blocks;
+    j["read_device"]["page_read"] = read_page_read;
+    j["read_device"]["pages_per_block"] =
+        static_cast<double>(read_page_read) / static_cast<double>(std::max<uint64_t>(1, read_device_blocks));
     j["raw_data"] = raw_data;
     j["compressed_data"] = compressed_data;
     j["write_logic_blocks"] = write_logic_blocks;
     j["write_unique_blocks"] = write_unique_blocks;
     j["page_write"] = page_write;
+    j["device_io"]["write_requests"] = device_write_ios;
+    j["device_io"]["read_requests"] = device_read_ios;
+    j["device_io"]["read_pages"] = device_read_pages;
+    j["segment"]["writes"] = segment_writes;
+    j["segment"]["page_write"] = segment_page_write;
+    j["segment"]["padding_pages"] = segment_padding_pages;
+    j["segment"]["cleaned"] = segment_cleaned;
+    j["segment"]["evicted"] = segment_evicted;
+    j["segment"]["clean_pages"] = segment_clean_pages;
+    // device pages written per page of newly flushed cachelines
+    j["segment"]["write_amplification"] =
+        static_cast<double>(segment_page_write) / static_cast<double>(std::max<uint64_t>(1, page_write));
+    j["allocator"]["requests"] = alloc_requests;
+    j["allocator"]["extents"] = alloc_extents;
+    j["allocator"]["extents_per_request"] =
+        static_cast<double>(alloc_extents) / static_cast<double>(std::max<uint64_t>(1, alloc_requests));
+    j["allocator"]["split_requests"] = alloc_split_requests;
+    j["allocator"]["free_extents"] = alloc_free_extents;
+    j["allocator"]["free_extents_max"] = alloc_free_extents_max;
+    j["allocator"]["largest_free_extent"] = alloc_largest_free_extent;
+    // share of the free space outside the largest free extent
+    j["allocator"]["external_fragmentation"] =
+        alloc_free_pages == 0
+            ? 0.0
+            : 1.0 - static_cast<double>(alloc_largest_free_extent) / static_cast<double>(alloc_free_pages);
     j["read_hit_ratio"] = static_cast<double>(read_hit) / static_cast<double>(read_io);
 
     j["promote"] = this->promote_cacheline;
     j["not_promote"] = this->not_promote_cacheline;
     j["evict_refs"] = this->evict_refs;
+    j["evict_cost"]["scored"] = evict_scored;
+    j["evict_cost"]["total"] = evict_cost;
+    j["evict_cost"]["per_eviction"] = evict_cost / static_cast<double>(std::max<uint64_t>(1, evict_scored));
+    j["evict_cost"]["max"] = evict_cost_max;
+    j["evict_cost"]["histogram"] = std::vector<uint64_t>(evict_cost_hist, evict_cost_hist + EVICT_COST_BUCKETS);
+    j["evict_cost"]["predicted_migration_bytes"] = evict_predicted_migration_bytes;
+    j["evict_cost"]["migrated_bytes"] = evict_migrated_bytes;
+    j["evict_cost"]["page_write"] = evict_page_write;
+    j["evict_cost"]["rewrites"] = evict_rewrites;
+    j["evict_cost"]["patches"] = evict_patches;
+    j["evict_cost"]["batches"] = evict_batches;
+    j["evict_cost"]["page_read"] = evict_page_read;
+    j["evict_cost"]["metadata_reads"] = evict_metadata_reads;
+    j["shared_block"]["promotions"] = shared_promotions;
+    j["shared_block"]["page_write"] = shared_page_write;
+    j["shared_block"]["pages"] = shared_pages;
+    j["shared_block"]["pages_max"] = shared_pages_max;
+    j["shared_block"]["bytes"] = shared_bytes;
+    j["gc"]["evict_stored_bytes"] = evict_stored_bytes;
+    j["gc"]["evict_dead_bytes"] = evict_dead_bytes;
+    j["gc"]["compactions"] = gc_compactions;
+    j["gc"]["pages_freed"] = gc_pages_freed;
+    j["gc"]["page_write"] = gc_page_write;
+    j["gc"]["bytes_dropped"] = gc_bytes_dropped;
+    j["gc"]["blocks_dropped"] = gc_blocks_dropped;
+    j["relocation"]["entries"] = relocation_entries;
+    j["relocation"]["entries_max"] = relocation_entries_max;
+    j["relocation"]["repaired"] = relocation_repaired;
+    j["relocation"]["deferred_rewrites"] = relocation_deferred_rewrites;
+    j["background_evict"]["evictions"] = background_evict;
+    j["background_evict"]["stalls"] = evict_stalls;
+    j["restart"]["cachelines"] = restart_cachelines;
+    j["restart"]["blocks"] = restart_blocks;
+    j["restart"]["shared_blocks"] = restart_shared_blocks;
+    j["restart"]["lbas"] = restart_lbas;
+    j["restart"]["page_read"] = restart_page_read;
+
+    j["detector"]["false_positive"] = detector_false_positive;
+    j["detector"]["true_negative"] = detector_true_negative;
+    j["detector"]["fp_rate"] = static_cast<double>(detector_false_positive) /
+                               static_cast<double>(std::max<uint64_t>(1, detector_false_positive + detector_true_negative));
+    j["detector"]["rebuild"] = detector_rebuild;
+    j["detector"]["insert_failures"] = detector_insert_failures;
+    j["detector"]["capacity"] = detector_capacity;
+    j["detector"]["estimated_fp_rate"] = detector_estimated_fp_rate;
 
     auto logical_data_write = globalEnv().c.dataset_block_size * write_logic_blocks;
     auto actual_data_write = page_write * 512 * globalEnv().c.page_granularity;
@@ -142,6 +319,10 @@ nlohmann::json Stat::toJson() {
     j["time"]["update_cache_line_index"] = time_update_cache_line_index / 1000000.0;
     j["time"]["evict_remove_cacheline"] = time_evict_remove_cacheline / 1000000.0;
     j["time"]["evict_update_index "] = time_evict_update_index / 1000000.0;
+    j["time"]["evict_stall"] = time_evict_stall / 1000000.0;
+    j["time"]["evict_stall_max"] = time_evict_stall_max / 1000000.0;
+    j["time"]["background_evict"] = time_background_evict / 1000000.0;
+    j["time"]["restart"] = time_restart / 1000000.0;
 
     // total
     j["time"]["total"] = time_process / 1000000.0;
@@ -1,9 +1,12 @@
 #include "device.h"
 
 #include <fcntl.h>
+#include <linux/io_uring.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <cassert>
@@ -51,6 +54,22 @@ namespace {
 
 AbstractBlockDevice::~AbstractBlockDevice() {}
 
+size_t AbstractBlockDevice::readv(const std::vector<ReadRun> &runs) {
+    size_t n = 0;
+    for (const auto &run : runs) {
+        n += this->read(run.addr, run.buf, run.len);
+    }
+    return n;
+}
+
+size_t AbstractBlockDevice::writev(const std::vector<WriteRun> &runs) {
+    size_t n = 0;
+    for (const auto &run : runs) {
+        n += this->write(run.addr, run.buf, run.len);
+    }
+    return n;
+}
+
 int EmptyBlockDevice::read(uint64_t addr, uint8_t *buf, uint32_t len) { return 512; }
 
 int EmptyBlockDevice::write(uint64_t addr, const uint8_t *buf, uint32_t len) { return 512; }
@@ -61,21 +80,21 @@ FileBlockDevice::FileBlockDevice() = default;
 
 bool FileBlockDevice::open(const char *filename, uint64_t size) {
     // 直接创建心的设备文件，不再打开已有的，不影响测试
-    // create new for test
-    return open_new_device(filename, size);
-
-    // struct stat stat_buf {};
-    // int handle = ::stat(filename, &stat_buf);
-    // if (handle == -1) {
-    //     if (errno == ENOENT) {
-    //         return open_new_device(filename, size);
-    //     } else {
-    //         // unexpected error
-    //         return -1;
-    //     }
-    // } else {
-    //     return open_existing_device(filename, size, &stat_buf);
-    // }
+    // create new for test, unless the cache is restarted from the device (Config::warm_restart)
+    if (!globalEnv().c.warm_restart) return open_new_device(filename, size);
+
+    struct stat stat_buf {};
+    int handle = ::stat(filename, &stat_buf);
+    if (handle == -1) {
+        if (errno == ENOENT) {
+            return open_new_device(filename, size);
+        } else {
+            // unexpected error
+            return false;
+        }
+    } else {
+        return open_existing_device(filename, size, &stat_buf);
+    }
 }
 
 int FileBlockDevice::write(uint64_t addr, const uint8_t *buf, uint32_t len) {
@@ -133,9 +152,9 @@ bool FileBlockDevice::open_new_device(const char *filename, uint64_t size) {
     LOGGER("Open a new device!");
     Assert(size > 0, "A new file needs to be created, however the size given is 0");
     auto flags = O_RDWR | O_CREAT;
-    // if (globalConfig().use_direct_io) {
-    //     flags |= O_DIRECT;
-    // }
+    if (globalEnv().c.use_direct_io) {
+        flags |= O_DIRECT;
+    }
 
     this->fd_ = ::open(filename, flags, 0666);
     this->size_ = size;
@@ -148,9 +167,9 @@ bool FileBlockDevice::open_new_device(const char *filename, uint64_t size) {
 bool FileBlockDevice::open_existing_device(const char *filename, uint64_t size, const struct stat *statbuf) {
     LOGGER("Open existing device");
     auto flag = O_RDWR;
-    // if (globalConfig().use_direct_io) {
-    //     flag |= O_DIRECT;
-    // }
+    if (globalEnv().c.use_direct_io) {
+        flag |= O_DIRECT;
+    }
     this->fd_ = ::open(filename, flag);
     Assert(this->fd_ > 0, "Open device %s failed with return fd value %d", filename, this->fd_);
 
@@ -159,6 +178,10 @@ bool FileBlockDevice::open_existing_device(const char *filename, uint64_t size,
             size = statbuf->st_size;
         else
             size = get_device_size(this->fd_);
+    } else if (S_ISREG(statbuf->st_mode) && static_cast<uint64_t>(statbuf->st_size) < size) {
+        // a file created for a smaller cache, the missing tail must read as zeros
+        Assert(::ftruncate(this->fd_, static_cast<long>(size)) == 0, "Can not extend device %s with error %s",
+               filename, std::strerror(errno));
     }
     this->size_ = size;
     return true;
@@ -196,3 +219,262 @@ bool MemBlockDevice::open(const char *filename, uint64_t size) {
 
 MemBlockDevice::MemBlockDevice() : device_buffer_(nullptr) {}
 MemBlockDevice::~MemBlockDevice() { delete[] this->device_buffer_; }
+
+struct UringBlockDevice::Ring {
+    int fd{-1};
+    void *sq_ptr{MAP_FAILED};
+    void *cq_ptr{MAP_FAILED};
+    size_t sq_len{0};
+    size_t cq_len{0};
+    io_uring_sqe *sqes{static_cast<io_uring_sqe *>(MAP_FAILED)};
+    size_t sqes_len{0};
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+
+    bool setup(unsigned entries) {
+        io_uring_params p{};
+        this->fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (this->fd < 0) return false;
+        this->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        this->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) this->sq_len = this->cq_len = std::max(this->sq_len, this->cq_len);
+        this->sq_ptr = ::mmap(nullptr, this->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd,
+                              IORING_OFF_SQ_RING);
+        if (this->sq_ptr == MAP_FAILED) return false;
+        this->cq_ptr = single ? this->sq_ptr
+                              : ::mmap(nullptr, this->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       this->fd, IORING_OFF_CQ_RING);
+        if (this->cq_ptr == MAP_FAILED) return false;
+        this->sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+        this->sqes = static_cast<io_uring_sqe *>(::mmap(nullptr, this->sqes_len, PROT_READ | PROT_WRITE,
+                                                        MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES));
+        if (this->sqes == MAP_FAILED) return false;
+        auto *sq = static_cast<uint8_t *>(this->sq_ptr);
+        auto *cq = static_cast<uint8_t *>(this->cq_ptr);
+        this->sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+        this->sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        this->sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        this->sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        this->cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        this->cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        this->cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        this->cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+        return true;
+    }
+
+    ~Ring() {
+        if (this->sqes != MAP_FAILED) ::munmap(this->sqes, this->sqes_len);
+        if (this->cq_ptr != MAP_FAILED && this->cq_ptr != this->sq_ptr) ::munmap(this->cq_ptr, this->cq_len);
+        if (this->sq_ptr != MAP_FAILED) ::munmap(this->sq_ptr, this->sq_len);
+        if (this->fd >= 0) ::close(this->fd);
+    }
+};
+
+namespace {
+    constexpr uint64_t READ_TAG = uint64_t{1} << 63;  // user data of a read (with its index), a write carries its slot
+}  // namespace
+
+UringBlockDevice::UringBlockDevice(unsigned queue_depth) : ring_(new Ring()), depth_(std::max(queue_depth, 1U)) {}
+
+UringBlockDevice::~UringBlockDevice() {
+    if (this->fd_ >= 0) {
+        this->drain();
+        ::close(this->fd_);
+    }
+    this->ring_.reset();
+    std::free(this->buffers_);
+}
+
+bool UringBlockDevice::open(const char *filename, uint64_t size) {
+    // writes hold at most one entry per slot and reads are capped at the same number, the completion queue (twice the
+    // submission queue) can not overflow
+    if (!this->ring_->setup(this->depth_)) {
+        ERROR("Can not set up io_uring with %u entries: %s", this->depth_, std::strerror(errno));
+        return false;
+    }
+    this->buffers_ = static_cast<uint8_t *>(std::aligned_alloc(4096, static_cast<size_t>(this->depth_) * SLOT_SIZE));
+    Assert(this->buffers_ != nullptr, "Can not allocate %u io_uring buffers", this->depth_);
+    std::vector<iovec> iovs(this->depth_);
+    this->slots_.assign(this->depth_, Slot{0, 0, false});
+    this->reads_.assign(this->depth_, PendingRead{0, nullptr, 0});
+    for (unsigned i = 0; i < this->depth_; i++) {
+        iovs[i] = {this->buffers_ + static_cast<size_t>(i) * SLOT_SIZE, SLOT_SIZE};
+        this->free_slots_.push_back(static_cast<int>(this->depth_ - 1 - i));
+        this->free_reads_.push_back(static_cast<int>(this->depth_ - 1 - i));
+    }
+    if (::syscall(__NR_io_uring_register, this->ring_->fd, IORING_REGISTER_BUFFERS, iovs.data(), this->depth_) < 0) {
+        ERROR("Can not register io_uring buffers: %s", std::strerror(errno));
+        return false;
+    }
+
+    this->fd_ = ::open(filename, O_RDWR | O_CREAT | (globalEnv().c.use_direct_io ? O_DIRECT : 0), 0666);
+    Assert(this->fd_ > 0, "Create device %s failure with returned fd %d", filename, this->fd_);
+    this->size_ = size;
+    Assert(::ftruncate(this->fd_, static_cast<long>(size)) == 0,
+           "Can not truncate the given block device with error %s", std::strerror(errno));
+    return true;
+}
+
+void UringBlockDevice::prepare(uint64_t tag) {
+    auto &ring = *this->ring_;
+    const auto tail = *ring.sq_tail;
+    if (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) == this->depth_) this->enter(0);
+    const auto index = tail & *ring.sq_mask;
+    auto &sqe = ring.sqes[index];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = this->fd_;
+    sqe.user_data = tag;
+    if (tag & READ_TAG) {
+        const auto &read = this->reads_[tag & ~READ_TAG];
+        sqe.opcode = IORING_OP_READ;
+        sqe.off = read.addr;
+        sqe.addr = reinterpret_cast<uint64_t>(read.buf);
+        sqe.len = read.len;
+    } else {
+        const auto &slot = this->slots_[tag];
+        sqe.opcode = IORING_OP_WRITE_FIXED;
+        sqe.buf_index = static_cast<uint16_t>(tag);
+        sqe.off = slot.addr;
+        sqe.addr = reinterpret_cast<uint64_t>(this->buffers_ + tag * SLOT_SIZE);
+        sqe.len = slot.len;
+    }
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++this->queued_;
+}
+
+void UringBlockDevice::enter(unsigned min_complete) {
+    const unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        const auto r = ::syscall(__NR_io_uring_enter, this->ring_->fd, this->queued_, min_complete, flags, nullptr, 0);
+        if (r >= 0) {
+            this->queued_ -= static_cast<unsigned>(r);
+            break;
+        }
+        Assert(errno == EINTR || errno == EAGAIN || errno == EBUSY, "io_uring_enter failure with error %s",
+               std::strerror(errno));
+        // completions have to be reaped before more can be submitted
+        if (errno != EINTR) this->reap();
+    }
+    this->reap();
+    // reap() only records short reads, prepare() may have to enter again to make room
+    while (!this->short_reads_.empty()) {
+        const auto index = this->short_reads_.back();
+        this->short_reads_.pop_back();
+        this->prepare(READ_TAG | static_cast<uint64_t>(index));
+    }
+}
+
+void UringBlockDevice::reap() {
+    auto &ring = *this->ring_;
+    auto head = *ring.cq_head;
+    const auto tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const auto &cqe = ring.cqes[head & *ring.cq_mask];
+        if (cqe.user_data & READ_TAG) {
+            const auto index = static_cast<int>(cqe.user_data & ~READ_TAG);
+            auto &read = this->reads_[index];
+            Assert(cqe.res > 0, "Block device read failure (%d of %u bytes at %lu): %s", cqe.res, read.len, read.addr,
+                   cqe.res < 0 ? std::strerror(-cqe.res) : "end of file");
+            const auto done = static_cast<uint32_t>(cqe.res);
+            read.addr += done;
+            read.buf += done;
+            read.len -= done;
+            if (read.len > 0) {
+                this->short_reads_.push_back(index);
+            } else {
+                this->free_reads_.push_back(index);
+                --this->reads_in_flight_;
+            }
+        } else {
+            auto &slot = this->slots_[cqe.user_data];
+            Assert(cqe.res == static_cast<int>(slot.len), "Block device write failure (%d of %u bytes): %s", cqe.res,
+                   slot.len, cqe.res < 0 ? std::strerror(-cqe.res) : "short write");
+            slot.busy = false;
+            this->free_slots_.push_back(static_cast<int>(cqe.user_data));
+        }
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+bool UringBlockDevice::overlapsWrite(uint64_t addr, uint32_t len) const {
+    return std::any_of(this->slots_.begin(), this->slots_.end(), [addr, len](const Slot &s) {
+        return s.busy && s.addr < addr + len && addr < s.addr + s.len;
+    });
+}
+
+bool UringBlockDevice::overlapsRead(uint64_t addr, uint32_t len) const {
+    return std::any_of(this->reads_.begin(), this->reads_.end(), [addr, len](const PendingRead &r) {
+        return r.len > 0 && r.addr < addr + len && addr < r.addr + r.len;
+    });
+}
+
+int UringBlockDevice::write(uint64_t addr, const uint8_t *buf, uint32_t len) {
+    return static_cast<int>(this->writev({{addr, buf, len}}));
+}
+
+size_t UringBlockDevice::writev(const std::vector<WriteRun> &runs) {
+    size_t n = 0;
+    for (auto run : runs) {
+        assert(run.addr % 512 == 0);
+        assert(run.len % 512 == 0);
+        if (run.addr + run.len > size_) run.len -= run.addr + run.len - size_;
+        for (uint32_t done = 0; done < run.len;) {
+            const auto len = std::min(SLOT_SIZE, run.len - done);
+            // io_uring does not order requests, the pages must not be read or written by one still in flight
+            while (this->overlapsWrite(run.addr + done, len) || this->overlapsRead(run.addr + done, len)) {
+                this->enter(1);
+            }
+            while (this->free_slots_.empty()) this->enter(1);
+            const auto slot = this->free_slots_.back();
+            this->free_slots_.pop_back();
+            this->slots_[slot] = {run.addr + done, len, true};
+            memcpy(this->buffers_ + static_cast<size_t>(slot) * SLOT_SIZE, run.buf + done, len);
+            this->prepare(static_cast<uint64_t>(slot));
+            done += len;
+        }
+        n += run.len;
+    }
+    this->enter(0);
+    return n;
+}
+
+int UringBlockDevice::read(uint64_t addr, uint8_t *buf, uint32_t len) {
+    return static_cast<int>(this->readv({{addr, buf, len}}));
+}
+
+size_t UringBlockDevice::readv(const std::vector<ReadRun> &runs) {
+    const auto n = this->submitReads(runs);
+    this->waitReads();
+    return n;
+}
+
+size_t UringBlockDevice::submitReads(const std::vector<ReadRun> &runs) {
+    size_t n = 0;
+    for (auto run : runs) {
+        assert(run.addr % 512 == 0);
+        assert(run.len % 512 == 0);
+        if (run.addr + run.len > size_) run.len -= run.addr + run.len - size_;
+        // io_uring does not order requests, a read must not pass a write to the same pages
+        while (this->overlapsWrite(run.addr, run.len)) this->enter(1);
+        while (this->free_reads_.empty()) this->enter(1);
+        const auto index = this->free_reads_.back();
+        this->free_reads_.pop_back();
+        this->reads_[index] = {run.addr, run.buf, run.len};
+        this->prepare(READ_TAG | static_cast<uint64_t>(index));
+        ++this->reads_in_flight_;
+        n += run.len;
+    }
+    this->enter(0);
+    return n;
+}
+
+void UringBlockDevice::waitReads() {
+    while (this->reads_in_flight_ > 0) this->enter(1);
+}
+
+void UringBlockDevice::drain() {
+    while (this->free_slots_.size() < this->depth_ || this->reads_in_flight_ > 0) this->enter(1);
+}
@@ -1,9 +1,13 @@
 #ifndef CDCACHE_BLOCKDETECTOR_H
 #define CDCACHE_BLOCKDETECTOR_H
+#include <cmath>
 #include <cstdint>
 #include <fstream>
 #include <unordered_set>
+#include <vector>
 
+#include "blocked_bloom_filter.h"
+#include "cuckoo_filter.h"
 #include "deletable_bloom_filter.h"
 
 // Data block detector, used to determine the type of a data block in advance
@@ -13,16 +17,84 @@ class AbstractBlockDetector {
     virtual void remove(uint64_t value) = 0;
     virtual bool query(uint64_t value) = 0;
     virtual void dumpInfo(){};
+    // Whether the detector is loaded beyond the capacity it was sized for and should be rebuilt
+    virtual bool overloaded() const { return false; }
+    // Rebuild the detector from the keys that are still alive
+    virtual void rebuild(const std::vector<uint64_t> & /*keys*/) {}
+    // Number of keys the detector is sized for (0 means unbounded)
+    virtual size_t capacity() const { return 0; }
+    // Estimated false-positive rate of the current state
+    virtual double estimatedFPRate() const { return 0; }
+    virtual ~AbstractBlockDetector() = default;
 };
 
-class BloomFilterDetector : public AbstractBlockDetector {
+/**
+ * Filter based detector sized for `capacity` keys at a target false-positive rate.
+ * Occupancy is measured by the fraction of set bits, which also accounts for evicted keys whose bits could not be
+ * cleared. Once the estimated false-positive rate (fill^K) exceeds the target the detector reports itself as
+ * overloaded, and `rebuild` re-creates the filter from the live keys, doubling the capacity until the live keys fill
+ * at most half of it.
+ */
+template <typename Filter>
+class ScalableFilterDetector : public AbstractBlockDetector {
    public:
+    ScalableFilterDetector(size_t capacity, double fp_rate)
+        : capacity_(capacity == 0 ? 1 : capacity),
+          fp_rate_(fp_rate),
+          filter_(bloomFilterBits(capacity_, Filter::HASHES, fp_rate)) {}
+
+    void insert(uint64_t value) override { this->filter_.insert(value); }
+    void remove(uint64_t value) override { this->filter_.remove(value); }
+    bool query(uint64_t value) override { return this->filter_.query(value); }
+
+    bool overloaded() const override { return this->estimatedFPRate() > this->fp_rate_; }
+
+    void rebuild(const std::vector<uint64_t> &keys) override {
+        while (keys.size() * 2 > this->capacity_) this->capacity_ *= 2;
+        this->filter_ = Filter(bloomFilterBits(this->capacity_, Filter::HASHES, this->fp_rate_));
+        for (auto k : keys) this->filter_.insert(k);
+    }
+
+    size_t capacity() const override { return this->capacity_; }
+
+    double estimatedFPRate() const override { return std::pow(this->filter_.fill(), Filter::HASHES); }
+
+   private:
+    size_t capacity_;
+    const double fp_rate_;
+    Filter filter_;
+};
+
+class BloomFilterDetector : public ScalableFilterDetector<DeletableBloomFilter<8>> {
+   public:
+    using ScalableFilterDetector::ScalableFilterDetector;
+};
+
+// All K bits of a key are in one cache line and derived from a single hash
+class BlockedBloomFilterDetector : public ScalableFilterDetector<BlockedBloomFilter<8>> {
+   public:
+    using ScalableFilterDetector::ScalableFilterDetector;
+};
+
+// Exact deletion, so evicted keys never linger. Grows like ScalableFilterDetector once the load passes
+// CuckooFilter::MAX_LOAD or a key could not be placed. A key the full filter rejects is kept in an exact overflow set
+// until the rebuild, so it can still be found and deleted.
+class CuckooFilterDetector : public AbstractBlockDetector {
+   public:
+    explicit CuckooFilterDetector(size_t capacity) : capacity_(capacity == 0 ? 1 : capacity), filter_(capacity_) {}
+
     void insert(uint64_t value) override;
     void remove(uint64_t value) override;
     bool query(uint64_t value) override;
+    bool overloaded() const override;
+    void rebuild(const std::vector<uint64_t> &keys) override;
+    size_t capacity() const override { return this->capacity_; }
+    double estimatedFPRate() const override;
 
    private:
-    DeletableBloomFilter<(1 << 14), 8> filter_;
+    size_t capacity_;
+    CuckooFilter filter_;
+    std::unordered_set<uint64_t> overflow_;
 };
 
 class SetDetector : public AbstractBlockDetector {
@@ -0,0 +1,107 @@
+#ifndef CDCACHE_BLOCKED_BLOOM_FILTER_H
+#define CDCACHE_BLOCKED_BLOOM_FILTER_H
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "xxhash.h"
+
+/**
+ * Deletable bloom filter whose K bits of a key all land in one 64-byte block (one CPU cache line).
+ * All bit positions are derived from a single 64-bit hash, and a block is checked with vector operations.
+ * Deletion follows DeletableBloomFilter: a bit is only cleared if it never collided.
+ */
+template <int K>
+class BlockedBloomFilter {
+    static constexpr int WORDS = 8;  // 8 * 64 bits = 512 bits = 64 bytes
+    static constexpr uint32_t BLOCK_BITS = WORDS * 64;
+
+    typedef uint64_t vec_t __attribute__((vector_size(32)));
+    struct alignas(64) Block {
+        vec_t v[2];
+    };
+
+   public:
+    static_assert(K > 0 && K <= 16);
+    static constexpr int HASHES = K;
+
+    BlockedBloomFilter(size_t bits, uint64_t seed) : seed_(seed) { this->resize(bits); }
+
+    explicit BlockedBloomFilter(size_t bits) : BlockedBloomFilter(bits, std::random_device{}()) {}
+
+    void insert(uint64_t value) {
+        Block mask;
+        const auto idx = this->locate(value, mask);
+        auto &block = this->slots_[idx];
+        auto &col = this->collisions_[idx];
+        for (int i = 0; i < 2; i++) {
+            col.v[i] |= block.v[i] & mask.v[i];
+            this->ones_ += popcount(mask.v[i] & ~block.v[i]);
+            block.v[i] |= mask.v[i];
+        }
+    }
+
+    void remove(uint64_t value) {
+        Block mask;
+        const auto idx = this->locate(value, mask);
+        auto &block = this->slots_[idx];
+        auto &col = this->collisions_[idx];
+        for (int i = 0; i < 2; i++) {
+            const vec_t cleared = block.v[i] & mask.v[i] & ~col.v[i];
+            this->ones_ -= popcount(cleared);
+            block.v[i] &= ~cleared;
+        }
+    }
+
+    [[nodiscard]] bool query(uint64_t value) const {
+        Block mask;
+        const auto &block = this->slots_[this->locate(value, mask)];
+        vec_t miss = (mask.v[0] & ~block.v[0]) | (mask.v[1] & ~block.v[1]);
+        return (miss[0] | miss[1] | miss[2] | miss[3]) == 0;
+    }
+
+    void clear() { this->resize(this->bits()); }
+
+    [[nodiscard]] size_t bits() const { return this->slots_.size() * BLOCK_BITS; }
+
+    // fraction of set bits, the false-positive rate is about fill^K
+    [[nodiscard]] double fill() const { return static_cast<double>(this->ones_) / static_cast<double>(this->bits()); }
+
+   private:
+    static inline size_t popcount(const vec_t &v) {
+        return __builtin_popcountll(v[0]) + __builtin_popcountll(v[1]) + __builtin_popcountll(v[2]) +
+               __builtin_popcountll(v[3]);
+    }
+
+    void resize(size_t bits) {
+        this->ones_ = 0;
+        auto n = (bits + BLOCK_BITS - 1) / BLOCK_BITS;
+        this->slots_.assign(n == 0 ? 1 : n, Block{});
+        this->collisions_.assign(this->slots_.size(), Block{});
+    }
+
+    // compute the K-bit mask of `value` and return the index of the block it falls into
+    size_t locate(uint64_t value, Block &mask) const {
+        const uint64_t h = XXH64(&value, sizeof(uint64_t), this->seed_);
+        // high 32 bits select the block, the low 32 bits drive double hashing inside it
+        const auto idx = ((h >> 32) * this->slots_.size()) >> 32;
+        const auto h1 = static_cast<uint32_t>(h & 0xffff);
+        const auto h2 = static_cast<uint32_t>((h >> 16) & 0xffff) | 1;
+        uint64_t words[WORDS] = {0};
+        for (uint32_t i = 0; i < K; i++) {
+            const auto bit = (h1 + i * h2) % BLOCK_BITS;
+            words[bit / 64] |= uint64_t{1} << (bit % 64);
+        }
+        mask.v[0] = vec_t{words[0], words[1], words[2], words[3]};
+        mask.v[1] = vec_t{words[4], words[5], words[6], words[7]};
+        return idx;
+    }
+
+    uint64_t seed_;
+    size_t ones_{0};
+    std::vector<Block> slots_;
+    std::vector<Block> collisions_;
+};
+
+#endif  // CDCACHE_BLOCKED_BLOOM_FILTER_H
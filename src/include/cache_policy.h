@@ -9,6 +9,7 @@
 #include <vector>
 
 #include "abstract_cache.h"
+#include "flat_index_map.h"
 template <typename T>
 class AbstractCachePolicy {
    public:
@@ -19,7 +20,7 @@ class AbstractCachePolicy {
     // Get the oldest key in the cache list for eviction (only get it without additional operations)
     virtual T oldest() = 0;
 
-    // for debug
+    // Get up to n keys in eviction order (oldest first), costs O(n)
     virtual std::vector<T> oldests(size_t n) { return {oldest()}; }
 
     // Move a key to the head (do nothing if the key does not exist)
@@ -30,439 +31,915 @@ class AbstractCachePolicy {
     // insert a key to cache policy (do nothing if the key dost not exist)
     virtual void insert(T t) = 0;
 
+    // Insert a key after a cache miss as if it had just been accessed. LRU puts it at the head, the scan-resistant
+    // policies only count the first access and keep it in their probationary part.
+    virtual void admit(T t) {
+        this->insert(t);
+        this->promote(t);
+    }
+
     [[nodiscard]] virtual size_t size() const = 0;
 };
 
+/**
+ * LRU on a flat slot array. Slots form a circular doubly linked list through prev/next indices with slot 0 as the
+ * sentinel, freed slots are reused through a free list and keys are found with an open-addressing map, so neither
+ * insert nor promote allocates.
+ */
 template <typename T>
 class LRUPolicy : public AbstractCachePolicy<T> {
+    static constexpr uint32_t HEAD = 0;
+    struct Slot {
+        T key{};
+        uint32_t prev{HEAD};
+        uint32_t next{HEAD};
+    };
+
    public:
-    T oldest() override { return this->list_.back(); }
+    LRUPolicy() : slots_(1) {}
+
+    T oldest() override { return this->slots_[this->slots_[HEAD].prev].key; }
     std::vector<T> oldests(size_t n) override {
-        auto real_size = std::min(n, this->list_.size());
-        auto it = this->list_.rbegin();
         std::vector<T> res;
-        while (it != this->list_.rend()) {
-            res.push_back(*it);
-            it++;
+        res.reserve(std::min(n, this->size()));
+        for (auto i = this->slots_[HEAD].prev; i != HEAD && res.size() < n; i = this->slots_[i].prev) {
+            res.push_back(this->slots_[i].key);
         }
         return res;
     }
 
     void promote(T t) override {
-        auto it = this->cache_.find(t);
-        if (it == this->cache_.end()) {
+        const auto i = this->index_.find(t);
+        if (i == FlatIndexMap<T>::NONE) {
             // Assert(false, "Can not promote an non-exist cache");
         } else {
-            this->list_.erase(this->cache_[t]);
-            this->list_.push_front(t);
-            this->cache_[t] = this->list_.begin();
+            this->unlink(i);
+            this->link(i, HEAD, this->slots_[HEAD].next);
+        }
+    }
+    void evict(T t) override {
+        const auto i = this->index_.find(t);
+        if (i != FlatIndexMap<T>::NONE) {
+            this->unlink(i);
+            this->index_.erase(t);
+            this->slots_[i].next = this->free_;
+            this->free_ = i;
+        }
+    }
+    void insert(T t) override {
+        if (this->index_.find(t) == FlatIndexMap<T>::NONE) {
+            uint32_t i = this->free_;
+            if (i != HEAD) {
+                this->free_ = this->slots_[i].next;
+            } else {
+                i = static_cast<uint32_t>(this->slots_.size());
+                this->slots_.emplace_back();
+            }
+            this->slots_[i].key = t;
+            this->link(i, this->slots_[HEAD].prev, HEAD);
+            this->index_.put(t, i);
+        }
+    }
+
+    [[nodiscard]] size_t size() const override { return this->index_.size(); }
+
+   private:
+    inline void unlink(uint32_t i) {
+        auto &s = this->slots_[i];
+        this->slots_[s.prev].next = s.next;
+        this->slots_[s.next].prev = s.prev;
+    }
+
+    inline void link(uint32_t i, uint32_t prev, uint32_t next) {
+        this->slots_[i].prev = prev;
+        this->slots_[i].next = next;
+        this->slots_[prev].next = i;
+        this->slots_[next].prev = i;
+    }
+
+    std::vector<Slot> slots_;  // slots_[HEAD].next is the most recent, slots_[HEAD].prev the oldest
+    uint32_t free_{HEAD};      // head of the free slot list, HEAD if there is none
+    FlatIndexMap<T> index_;
+};
+
+/**
+ * O(1) LFU (Shah et al.): keys are grouped into buckets of equal frequency kept in ascending order, and each bucket is
+ * an LRU list so ties are broken by recency.
+ */
+template <typename T>
+class LFUPolicy : public AbstractCachePolicy<T> {
+    struct Bucket {
+        size_t freq{0};
+        std::list<T> keys;  // front is the most recent
+    };
+    using BucketIter = typename std::list<Bucket>::iterator;
+    struct Node {
+        BucketIter bucket;
+        typename std::list<T>::iterator key;
+    };
+
+   public:
+    // 频率最低的桶中最久未访问的一个
+    T oldest() override {
+        Assert(!this->buckets_.empty(), "Oldest: empty LFU policy");
+        return this->buckets_.front().keys.back();
+    }
+
+    std::vector<T> oldests(size_t n) override {
+        std::vector<T> res;
+        res.reserve(std::min(n, this->table_.size()));
+        for (auto b = this->buckets_.begin(); b != this->buckets_.end() && res.size() < n; ++b) {
+            for (auto it = b->keys.rbegin(); it != b->keys.rend() && res.size() < n; ++it) {
+                res.push_back(*it);
+            }
+        }
+        return res;
+    }
+
+    void promote(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end()) return;
+        auto cur = it->second.bucket;
+        auto next = std::next(cur);
+        if (next == this->buckets_.end() || next->freq != cur->freq + 1) {
+            next = this->buckets_.insert(next, Bucket{cur->freq + 1, {}});
+        }
+        next->keys.splice(next->keys.begin(), cur->keys, it->second.key);
+        it->second.bucket = next;
+        if (cur->keys.empty()) this->buckets_.erase(cur);
+    }
+
+    void evict(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end()) return;
+        auto bucket = it->second.bucket;
+        bucket->keys.erase(it->second.key);
+        if (bucket->keys.empty()) this->buckets_.erase(bucket);
+        this->table_.erase(it);
+    }
+
+    void insert(T t) override {
+        if (this->table_.count(t)) return;
+        if (this->buckets_.empty() || this->buckets_.front().freq != 1) {
+            this->buckets_.push_front(Bucket{1, {}});
+        }
+        auto bucket = this->buckets_.begin();
+        bucket->keys.push_front(t);
+        this->table_[t] = Node{bucket, bucket->keys.begin()};
+    }
+
+    void admit(T t) override { this->insert(t); }
+
+    [[nodiscard]] size_t size() const override { return this->table_.size(); }
+
+   private:
+    std::list<Bucket> buckets_;  // ascending frequency, no empty bucket
+    std::unordered_map<T, Node> table_;
+};
+
+/**
+ * ARC (Megiddo and Modha, FAST'03). T1 holds keys seen once and T2 keys seen at least twice, B1/B2 remember keys
+ * evicted from them. A ghost hit in B1 (B2) grows (shrinks) the target size p of T1.
+ * The cache decides when to evict, so the capacity c is the largest resident count seen so far.
+ */
+template <typename T>
+class ARCPolicy : public AbstractCachePolicy<T> {
+    enum ListType { T1 = 0, T2 = 1, B1 = 2, B2 = 3 };
+    struct Node {
+        ListType type{T1};
+        typename std::list<T>::iterator it;
+    };
+
+   public:
+    T oldest() override {
+        Assert(this->size() > 0, "Oldest: empty ARC policy");
+        return this->replaceT1(this->lists_[T1].size(), this->lists_[T2].size()) ? this->lists_[T1].back()
+                                                                                 : this->lists_[T2].back();
+    }
+
+    std::vector<T> oldests(size_t n) override {
+        std::vector<T> res;
+        res.reserve(std::min(n, this->size()));
+        auto t1 = this->lists_[T1].rbegin();
+        auto t2 = this->lists_[T2].rbegin();
+        size_t n1 = this->lists_[T1].size(), n2 = this->lists_[T2].size();
+        while (res.size() < n && n1 + n2 > 0) {
+            if (this->replaceT1(n1, n2)) {
+                res.push_back(*t1++);
+                n1--;
+            } else {
+                res.push_back(*t2++);
+                n2--;
+            }
+        }
+        return res;
+    }
+
+    // hit in T1 or T2: move to the MRU end of T2
+    void promote(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end() || it->second.type >= B1) return;
+        this->move(it->second, T2);
+    }
+
+    // a resident key leaves the cache and is remembered in the matching ghost list
+    void evict(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end() || it->second.type >= B1) return;
+        this->move(it->second, it->second.type == T1 ? B1 : B2);
+        this->trimGhosts();
+    }
+
+    void insert(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end()) {
+            auto &l = this->lists_[T1];
+            l.push_front(t);
+            this->table_[t] = Node{T1, l.begin()};
+            this->capacity_ = std::max(this->capacity_, this->size());
+            this->trimGhosts();
+            return;
+        }
+        auto &node = it->second;
+        const double b1 = static_cast<double>(this->lists_[B1].size());
+        const double b2 = static_cast<double>(this->lists_[B2].size());
+        if (node.type == B1) {
+            this->p_ = std::min(static_cast<double>(this->capacity_), this->p_ + std::max(b2 / b1, 1.0));
+        } else if (node.type == B2) {
+            this->p_ = std::max(0.0, this->p_ - std::max(b1 / b2, 1.0));
+        } else {
+            return;  // already resident
+        }
+        this->move(node, T2);
+        this->capacity_ = std::max(this->capacity_, this->size());
+    }
+
+    void admit(T t) override { this->insert(t); }
+
+    [[nodiscard]] size_t size() const override { return this->lists_[T1].size() + this->lists_[T2].size(); }
+
+   private:
+    // REPLACE of ARC: take the LRU of T1 if T1 exceeds its target
+    [[nodiscard]] inline bool replaceT1(size_t n1, size_t n2) const {
+        return n1 > 0 && (n2 == 0 || static_cast<double>(n1) > this->p_);
+    }
+
+    void move(Node &node, ListType to) {
+        auto &dst = this->lists_[to];
+        dst.splice(dst.begin(), this->lists_[node.type], node.it);
+        node.type = to;
+        node.it = dst.begin();
+    }
+
+    // keep |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c
+    void trimGhosts() {
+        auto drop = [this](ListType type) {
+            auto &l = this->lists_[type];
+            this->table_.erase(l.back());
+            l.pop_back();
+        };
+        while (!this->lists_[B1].empty() && this->lists_[T1].size() + this->lists_[B1].size() > this->capacity_) {
+            drop(B1);
+        }
+        while (this->size() + this->lists_[B1].size() + this->lists_[B2].size() > 2 * this->capacity_) {
+            if (!this->lists_[B2].empty()) {
+                drop(B2);
+            } else if (!this->lists_[B1].empty()) {
+                drop(B1);
+            } else {
+                break;
+            }
+        }
+    }
+
+    std::list<T> lists_[4];  // front is MRU
+    std::unordered_map<T, Node> table_;
+    size_t capacity_{0};
+    double p_{0};  // target size of T1
+};
+
+/**
+ * LIRS (Jiang and Zhang, SIGMETRICS'02). Keys with a small inter-reference recency (LIR) stay resident, the victims
+ * come from the queue Q of resident HIR keys, which takes about 1% of the cache.
+ * The stack S orders LIR keys and (resident or not) HIR keys by recency and its bottom is always a LIR key.
+ * Non-resident HIR keys are capped at the capacity and the oldest ones are forgotten first.
+ */
+template <typename T>
+class LIRSPolicy : public AbstractCachePolicy<T> {
+    enum PageType { LIR = 0, R_HIR = 1, N_HIR = 2 };
+    using Iter = typename std::list<T>::iterator;
+    struct Node {
+        PageType type{R_HIR};
+        bool in_s{false};
+        Iter s_it;
+        Iter q_it;      // valid for R_HIR
+        Iter ghost_it;  // valid for N_HIR
+    };
+
+   public:
+    T oldest() override {
+        if (!this->q_.empty()) return this->q_.front();
+        Assert(!this->s_.empty(), "Oldest: empty LIRS policy");
+        return this->s_.back();
+    }
+
+    std::vector<T> oldests(size_t n) override {
+        std::vector<T> res;
+        res.reserve(std::min(n, this->size()));
+        for (auto it = this->q_.begin(); it != this->q_.end() && res.size() < n; ++it) res.push_back(*it);
+        // then the least recent LIR keys
+        for (auto it = this->s_.rbegin(); it != this->s_.rend() && res.size() < n; ++it) {
+            if (this->table_.find(*it)->second.type == LIR) res.push_back(*it);
+        }
+        return res;
+    }
+
+    void promote(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end()) return;
+        auto &node = it->second;
+        if (node.type == LIR) {
+            this->s_.splice(this->s_.begin(), this->s_, node.s_it);
+            this->pruning();
+        } else if (node.type == R_HIR) {
+            if (node.in_s) {
+                // its recency is smaller than the oldest LIR: swap their status
+                this->q_.erase(node.q_it);
+                this->s_.splice(this->s_.begin(), this->s_, node.s_it);
+                node.type = LIR;
+                this->lir_size_++;
+                this->demoteBottomLIR(t);
+            } else {
+                this->pushS(t, node);
+                this->q_.splice(this->q_.end(), this->q_, node.q_it);
+            }
+        }
+    }
+
+    void evict(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end()) return;
+        auto &node = it->second;
+        if (node.type == R_HIR) {
+            this->q_.erase(node.q_it);
+            this->resident_--;
+            if (node.in_s) {
+                node.type = N_HIR;
+                this->ghosts_.push_back(t);
+                node.ghost_it = std::prev(this->ghosts_.end());
+                this->trimGhosts();
+            } else {
+                this->table_.erase(it);
+            }
+        } else if (node.type == LIR) {
+            // the cache chose a LIR key itself
+            const bool bottom = node.s_it == std::prev(this->s_.end());
+            this->s_.erase(node.s_it);
+            this->lir_size_--;
+            this->resident_--;
+            this->table_.erase(it);
+            if (bottom) this->pruning();
+        }
+    }
+
+    void insert(T t) override {
+        auto it = this->table_.find(t);
+        if (it != this->table_.end() && it->second.type != N_HIR) return;
+        this->resident_++;
+        this->capacity_ = std::max(this->capacity_, this->resident_);
+        const size_t hir_target = std::max<size_t>(1, this->capacity_ / 100);
+
+        if (it != this->table_.end()) {
+            // non-resident HIR still in S: becomes LIR
+            auto &node = it->second;
+            this->ghosts_.erase(node.ghost_it);
+            this->s_.splice(this->s_.begin(), this->s_, node.s_it);
+            node.type = LIR;
+            this->lir_size_++;
+            this->demoteBottomLIR(t);
+            return;
+        }
+
+        auto &node = this->table_[t];
+        this->pushS(t, node);
+        if (this->q_.size() >= hir_target) {
+            node.type = LIR;  // HIR part is full, the LIR set is still growing
+            this->lir_size_++;
+        } else {
+            node.type = R_HIR;
+            this->q_.push_back(t);
+            node.q_it = std::prev(this->q_.end());
+        }
+    }
+
+    void admit(T t) override { this->insert(t); }
+
+    [[nodiscard]] size_t size() const override { return this->resident_; }
+
+   private:
+    void pushS(T t, Node &node) {
+        if (node.in_s) {
+            this->s_.splice(this->s_.begin(), this->s_, node.s_it);
+        } else {
+            this->s_.push_front(t);
+            node.s_it = this->s_.begin();
+            node.in_s = true;
         }
     }
+
+    // the LIR key at the bottom of S becomes a resident HIR key at the end of Q (unless it is `promoted` itself)
+    void demoteBottomLIR(T promoted) {
+        this->pruning();
+        if (this->s_.empty() || this->s_.back() == promoted) return;
+        const auto bottom = this->s_.back();
+        auto &node = this->table_.find(bottom)->second;
+        this->s_.pop_back();
+        node.in_s = false;
+        node.type = R_HIR;
+        this->lir_size_--;
+        this->q_.push_back(bottom);
+        node.q_it = std::prev(this->q_.end());
+        this->pruning();
+    }
+
+    // remove HIR keys from the bottom of S until a LIR key is there
+    void pruning() {
+        while (!this->s_.empty()) {
+            const auto back = this->s_.back();
+            auto it = this->table_.find(back);
+            if (it->second.type == LIR) break;
+            this->s_.pop_back();
+            it->second.in_s = false;
+            if (it->second.type == N_HIR) {
+                this->ghosts_.erase(it->second.ghost_it);
+                this->table_.erase(it);
+            }
+        }
+    }
+
+    void trimGhosts() {
+        while (this->ghosts_.size() > this->capacity_) {
+            auto it = this->table_.find(this->ghosts_.front());
+            this->ghosts_.pop_front();
+            this->s_.erase(it->second.s_it);
+            this->table_.erase(it);
+        }
+    }
+
+    std::list<T> s_;       // front is the top of the stack
+    std::list<T> q_;       // front is the next victim
+    std::list<T> ghosts_;  // non-resident HIR keys in the order they left the cache
+    std::unordered_map<T, Node> table_;
+    size_t lir_size_{0};
+    size_t resident_{0};
+    size_t capacity_{0};
+};
+
+/**
+ * Full 2Q (Johnson and Shasha, VLDB'94). New keys enter the FIFO A1in, re-references inside A1in are ignored, and
+ * keys evicted from A1in are remembered in the ghost FIFO A1out. A miss that hits A1out goes to the LRU Am.
+ * A1in takes about 25% of the resident keys and A1out remembers up to 50%.
+ */
+template <typename T>
+class TwoQPolicy : public AbstractCachePolicy<T> {
+    enum ListType { A1IN = 0, AM = 1, A1OUT = 2 };
+    struct Node {
+        ListType type{A1IN};
+        typename std::list<T>::iterator it;
+    };
+
+   public:
+    T oldest() override {
+        Assert(this->size() > 0, "Oldest: empty 2Q policy");
+        return this->fromA1in(this->lists_[A1IN].size(), this->lists_[AM].size()) ? this->lists_[A1IN].back()
+                                                                                   : this->lists_[AM].back();
+    }
+
+    std::vector<T> oldests(size_t n) override {
+        std::vector<T> res;
+        res.reserve(std::min(n, this->size()));
+        auto in = this->lists_[A1IN].rbegin();
+        auto am = this->lists_[AM].rbegin();
+        size_t n_in = this->lists_[A1IN].size(), n_am = this->lists_[AM].size();
+        while (res.size() < n && n_in + n_am > 0) {
+            if (this->fromA1in(n_in, n_am)) {
+                res.push_back(*in++);
+                n_in--;
+            } else {
+                res.push_back(*am++);
+                n_am--;
+            }
+        }
+        return res;
+    }
+
+    void promote(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end() || it->second.type != AM) return;
+        this->move(it->second, AM);
+    }
+
     void evict(T t) override {
-        auto it = this->cache_.find(t);
-        if (it != this->cache_.end()) {
-            this->list_.erase(it->second);
-            this->cache_.erase(it);
+        auto it = this->table_.find(t);
+        if (it == this->table_.end()) return;
+        if (it->second.type == A1IN) {
+            this->move(it->second, A1OUT);
+            const size_t k_out = std::max<size_t>(1, this->size() / 2);
+            auto &out = this->lists_[A1OUT];
+            while (out.size() > k_out) {
+                this->table_.erase(out.back());
+                out.pop_back();
+            }
+        } else if (it->second.type == AM) {
+            this->lists_[AM].erase(it->second.it);
+            this->table_.erase(it);
+        }
+    }
+
+    void insert(T t) override {
+        auto it = this->table_.find(t);
+        if (it == this->table_.end()) {
+            auto &l = this->lists_[A1IN];
+            l.push_front(t);
+            this->table_[t] = Node{A1IN, l.begin()};
+        } else if (it->second.type == A1OUT) {
+            this->move(it->second, AM);
         }
     }
+
+    void admit(T t) override { this->insert(t); }
+
+    [[nodiscard]] size_t size() const override { return this->lists_[A1IN].size() + this->lists_[AM].size(); }
+
+   private:
+    [[nodiscard]] static inline bool fromA1in(size_t n_in, size_t n_am) {
+        return n_in > 0 && (n_am == 0 || n_in * 4 > n_in + n_am);
+    }
+
+    void move(Node &node, ListType to) {
+        auto &dst = this->lists_[to];
+        dst.splice(dst.begin(), this->lists_[node.type], node.it);
+        node.type = to;
+        node.it = dst.begin();
+    }
+
+    std::list<T> lists_[3];  // front is the most recent
+    std::unordered_map<T, Node> table_;
+};
+
+/**
+ * S3-FIFO (Yang et al., SOSP'23). New keys enter a small FIFO that takes about 10% of the cache. Keys re-accessed
+ * while in it move to the main FIFO, the others are evicted early and remembered in a ghost FIFO; a miss on a ghost
+ * key goes straight to main. Main is a FIFO with reinsertion: a key with a non-zero counter is moved to the back and
+ * its counter decremented. A hit only bumps a 2-bit counter, no queue is touched.
+ * Keys evicted out of order (not at a queue front) are marked dead and dropped when their queue reaches them.
+ */
+template <typename T>
+class S3FIFOPolicy : public AbstractCachePolicy<T> {
+    enum Queue : uint8_t { SMALL = 0, MAIN = 1, DEAD = 2 };
+    static constexpr uint8_t MAX_FREQ = 3;
+    struct Slot {
+        T key{};
+        uint8_t freq{0};
+        Queue queue{DEAD};
+    };
+
+   public:
+    // moves keys between the queues until the front of one of them is a victim
+    T oldest() override { return this->slots_[this->victim()].key; }
+
+    std::vector<T> oldests(size_t n) override {
+        std::vector<T> res;
+        if (this->size() == 0) return res;
+        this->victim();
+        res.reserve(std::min(n, this->size()));
+        // replay the eviction rule without moving anything, reinserted keys are not visited again
+        size_t ns = this->small_size_, nm = this->main_size_, si = 0, mi = 0;
+        while (res.size() < n) {
+            if (ns > 0 && (ns >= this->smallTarget() || nm == 0)) {
+                if (si == this->small_.size()) break;
+                const auto &s = this->slots_[this->small_[si++]];
+                if (s.queue == DEAD) continue;
+                ns--;
+                if (s.freq > 0) {
+                    nm++;
+                } else {
+                    res.push_back(s.key);
+                }
+            } else {
+                if (mi == this->main_.size()) break;
+                const auto &s = this->slots_[this->main_[mi++]];
+                if (s.queue == DEAD || s.freq > 0) continue;
+                nm--;
+                res.push_back(s.key);
+            }
+        }
+        return res;
+    }
+
+    void promote(T t) override {
+        const auto i = this->index_.find(t);
+        if (i == FlatIndexMap<T>::NONE) return;
+        auto &s = this->slots_[i];
+        if (s.freq < MAX_FREQ) s.freq++;
+    }
+
+    void evict(T t) override {
+        const auto i = this->index_.find(t);
+        if (i == FlatIndexMap<T>::NONE) return;
+        this->index_.erase(t);
+        auto &s = this->slots_[i];
+        if (s.queue == SMALL) {
+            this->small_size_--;
+            this->remember(t);
+        } else {
+            this->main_size_--;
+        }
+        s.queue = DEAD;  // released when its queue pops it
+    }
+
     void insert(T t) override {
-        auto it = this->cache_.find(t);
-        if (it == this->cache_.end()) {
-            this->list_.push_back(t);
-            this->cache_[t] = std::prev(this->list_.end());
+        if (this->index_.find(t) != FlatIndexMap<T>::NONE) return;
+        this->capacity_ = std::max(this->capacity_, this->size() + 1);
+        uint32_t i;
+        if (!this->free_.empty()) {
+            i = this->free_.back();
+            this->free_.pop_back();
+        } else {
+            i = static_cast<uint32_t>(this->slots_.size());
+            this->slots_.emplace_back();
+        }
+        auto &s = this->slots_[i];
+        s.key = t;
+        s.freq = 0;
+        if (this->ghost_index_.erase(t)) {
+            s.queue = MAIN;
+            this->main_.push_back(i);
+            this->main_size_++;
+        } else {
+            s.queue = SMALL;
+            this->small_.push_back(i);
+            this->small_size_++;
         }
+        this->index_.put(t, i);
     }
 
-    [[nodiscard]] size_t size() const override { return this->list_.size(); }
+    void admit(T t) override { this->insert(t); }
+
+    [[nodiscard]] size_t size() const override { return this->small_size_ + this->main_size_; }
 
    private:
-    std::list<T> list_;
-    std::unordered_map<T, typename std::list<T>::iterator> cache_;
+    [[nodiscard]] inline size_t smallTarget() const { return std::max<size_t>(1, this->capacity_ / 10); }
+
+    uint32_t victim() {
+        Assert(this->size() > 0, "Oldest: empty S3-FIFO policy");
+        while (true) {
+            const bool from_small =
+                this->small_size_ > 0 && (this->small_size_ >= this->smallTarget() || this->main_size_ == 0);
+            auto &queue = from_small ? this->small_ : this->main_;
+            const auto i = queue.front();
+            auto &s = this->slots_[i];
+            if (s.queue == DEAD) {
+                queue.pop_front();
+                this->free_.push_back(i);
+            } else if (s.freq == 0) {
+                return i;
+            } else if (from_small) {
+                // re-accessed while in the small queue
+                queue.pop_front();
+                s.queue = MAIN;
+                s.freq = 0;
+                this->main_.push_back(i);
+                this->small_size_--;
+                this->main_size_++;
+            } else {
+                queue.pop_front();
+                s.freq--;
+                this->main_.push_back(i);
+            }
+        }
+    }
+
+    // ghost FIFO as large as the main queue
+    void remember(T t) {
+        if (++this->ghost_seq_ == FlatIndexMap<T>::NONE) this->ghost_seq_ = 0;
+        this->ghost_.emplace_back(t, this->ghost_seq_);
+        this->ghost_index_.put(t, this->ghost_seq_);
+        while (this->ghost_.size() > this->capacity_ - this->smallTarget()) {
+            const auto [key, seq] = this->ghost_.front();
+            // the key may have been readmitted or remembered again since then
+            if (this->ghost_index_.find(key) == seq) this->ghost_index_.erase(key);
+            this->ghost_.pop_front();
+        }
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_;
+    std::deque<uint32_t> small_, main_;  // front is the oldest
+    size_t small_size_{0}, main_size_{0};
+    FlatIndexMap<T> index_;
+    std::deque<std::pair<T, uint32_t>> ghost_;
+    FlatIndexMap<T> ghost_index_;
+    uint32_t ghost_seq_{0};
+    size_t capacity_{0};
 };
 
-// template <typename T>
-// class LFUPolicy : public AbstractCachePolicy<T> {
-//    public:
-//     struct Node {
-//         T key{};
-//         int freq{0};
-//     };
-
-//    public:
-//     // 频率最低的最后访问的一个
-//     T oldest() override {
-//         Assert(!this->freq_table_.empty() && (!this->freq_table_.begin()->second.empty()), "Oldest inconsistent
-//         Data"); return this->freq_table_.begin()->second.back().key;
-//     }
-
-//     void promote(T t) override {}
-
-//     // remove from table
-//     void evict(T t) override {
-//         auto it = key_table_.find(t);
-//         if (it == key_table_.end()) return;  // return if not found
-//         auto freq = it->second->freq;
-//         this->key_table_.erase(it);
-//         this->freq_table_[freq].erase(it->second);
-//         if (freq_table_[freq].empty()) {
-//             freq_table_.erase(freq);
-//         }
-//     }
-
-//     void insert(T t) override {
-//         auto it = this->key_table_.find(t);
-//         if (it != key_table_.end()) {
-//             // update freq
-//             auto freq = it->second->freq;                     // get freq
-//             this->evict(t);                                   // remove old entry
-//             freq_table_[freq + 1].push_front({t, freq + 1});  // add new entry
-//             key_table_[t] = freq_table_[freq + 1].begin();
-//         } else {
-//             freq_table_[1].push_front({t, 1});       // insert into freq[1]
-//             key_table_[t] = freq_table_[1].begin();  // update key_table//        min_freq_ = 1; // update min_freq
-//         }
-//     }
-
-//     [[nodiscard]] size_t size() const override { return this->key_table_.size(); }
-
-//    private:
-//     std::unordered_map<T, typename std::list<Node>::iterator> key_table_;
-//     // 频率 -> 该频率对应的所有数据块
-//     std::map<int, std::list<Node>> freq_table_;
-// };
-
-// template <typename T>
-// class ARCPolicy : public AbstractCachePolicy<T> {
-//    public:
-//     T oldest() override {
-//         if (t1_.empty() && t2_.empty()) {
-//             throw std::runtime_error("[ARC.oldest] invalid cache content");
-//         }
-//         if (t1_.empty()) {
-//             return t2_.back();
-//         }
-//         if (t2_.empty()) {
-//             return t1_.back();
-//         }
-
-//         double current_prop = static_cast<double>(t1_.size()) / static_cast<double>(t2_.size());
-//         if (current_prop > this->prop_) {
-//             return t1_.back();
-//         } else {
-//             return t2_.back();
-//         }
-//     }
-//     void promote(T t) override {}
-//     void evict(T key) override {
-//         auto it1 = this->t1_table_.find(key);
-//         if (it1 != this->t1_table_.end()) {
-//             move_list(t1_, t1_table_, it1->second, b1_, b1_table_, key);
-//             auto last = this->b1_.back();
-//             this->b1_table_.erase(last);
-//             this->b1_.pop_back();
-
-//             return;
-//         }
-
-//         auto it2 = this->t2_table_.find(key);
-//         if (it2 != this->t2_table_.end()) {
-//             move_list(t2_, t2_table_, it2->second, b2_, b2_table_, key);
-//             auto last = this->b2_.back();
-//             this->b2_table_.erase(last);
-//             this->b2_.pop_back();
-//             return;
-//         }
-//         throw std::runtime_error("[ARC.evict] invalid cache content");
-//     }
-
-//     void insert(T key) override {
-//         // CASE 1
-//         auto it1 = t1_table_.find(key);
-//         if (it1 != t1_table_.end()) {
-//             // hit T1 --> move to T2 MRU
-//             move_list(t1_, t1_table_, it1->second, t2_, t2_table_, key);
-//             return;
-//         }
-
-//         auto it2 = t2_table_.find(key);
-//         if (it2 != t2_table_.end()) {
-//             // hit T2 move to T2 MRU
-//             move_list(t2_, t2_table_, it2->second, t2_, t2_table_, key);
-
-//             replace(key);
-//             return;
-//         }
-
-//         auto bit1 = b1_table_.find(key);
-//         if (bit1 != b1_table_.end()) {
-//             // in B1 move to t2 MRU
-//             move_list(b1_, b1_table_, bit1->second, t2_, t2_table_, key);
-//             auto diff = this->b1_.size() >= this->b2_.size()
-//                             ? 0.1
-//                             : static_cast<double>(this->b2_.size()) / static_cast<double>(this->b1_.size());
-
-//             this->prop_ = std::min(this->prop_ + diff, 0.5);
-
-//             // p1++ p2--
-//             return;
-//         }
-
-//         auto bit2 = b2_table_.find(key);
-//         if (bit2 != b2_table_.end()) {
-//             // in B2 move to t2 MRU
-//             // p1-- p2++
-//             auto diff = this->b2_.size() >= this->b1_.size()
-//                             ? 0.1
-//                             : static_cast<double>(this->b1_.size()) / static_cast<double>(this->b2_.size());
-//             this->prop_ = std::min(this->prop_ - diff, 0.0);
-//             move_list(b2_, b2_table_, bit2->second, t2_, t2_table_, key);
-//             return;
-//         }
-
-//         // insert into T1 MRU
-//         this->t1_.push_front(key);
-//         this->t1_table_[key] = this->t1_.begin();
-//     }
-//     [[nodiscard]] size_t size() const override { return 0; }
-
-//    private:
-//     void move_list(std::list<T> &from, std::unordered_map<T, typename std::list<T>::iterator> &from_table_,
-//                    typename std::list<T>::iterator iter, std::list<T> &to,
-//                    std::unordered_map<T, typename std::list<T>::iterator> &to_table_, const T &key) {
-//         assert(iter != from.end());
-//         from.erase(iter);
-//         from_table_.erase(key);
-//         to.push_front(key);
-//         to_table_[key] = to.begin();
-//     }
-
-//     void replace(int key) {
-//         // TODO: 这里不能手动逐出，会导致数据不同步
-
-//         // move LRU T1 to B1
-//         // or
-//         // move LRU T2 to B2
-//     }
-
-//     std::list<T> t1_;
-//     std::list<T> t2_;
-//     std::unordered_map<T, typename std::list<T>::iterator> t1_table_, t2_table_;
-//     std::list<T> b1_;
-//     std::list<T> b2_;
-//     std::unordered_map<T, typename std::list<T>::iterator> b1_table_, b2_table_;
-//     // 定义T1 和 T2 缓存的一个比例
-//     double prop_{1.0};
-// };
-
-// template <typename T>
-// class LIRSPolicy : public AbstractCachePolicy<T> {
-//     enum PageType { LIR = 0, R_HIR = 1, N_HIR = 2, Invalid = 3 };
-
-//     struct Node {
-//         T value{};
-//         PageType type{Invalid};
-//     };
-
-//    public:
-//     T oldest() override {
-//         if (!this->q_.empty()) return this->q_.back().value;
-//         //        printf("Warn: Empty queue Q");
-//         //        if (!this->s_.empty()) return this->s_.back().value;
-//         Assert(false, "Oldest: Invalid data_block content");
-//         return T{};
-//     }
-
-//     void promote(T t) override {}
-
-//     // 逐出
-//     void evict(T t) override {
-//         if (this->q_table_.count(t)) {
-//             Assert(!this->q_.empty() && this->q_.back().value == t, "Evict1: Invalid DataBlock Content");
-//             this->q_.pop_back();
-//             this->q_table_.erase(t);
-
-//             auto it = this->s_table_.find(t);
-//             if (it != this->s_table_.end()) {
-//                 if (it->second->type != N_HIR) {
-//                     this->s_size_--;
-//                 }
-//                 it->second->type = N_HIR;
-//             }
-//         } else if (this->s_table_.count(t)) {
-//             Assert(!this->s_.empty() && this->s_.back().value == t && this->q_.empty(),
-//                    "Evict2: Invalid DataBlock Content");
-//             this->s_.pop_back();
-//             this->s_table_.erase(t);
-//             this->pruning(this->s_, this->s_table_);
-//         }
-//     }
-//     void insert(T t) override {
-//         auto it = this->s_table_.find(t);
-//         // Case LIR, erase and move to top
-//         if (it != this->s_table_.end() && it->second->type == LIR) {
-//             this->moveToTop(this->s_, this->s_table_, t, LIR);
-//             this->pruning(this->s_, this->s_table_);
-//             return;
-//         }
-
-//         // N-HIR
-//         if (it != this->s_table_.end() && it->second->type == N_HIR) {
-//             // 移动到顶部并标记为LIR
-//             this->moveToTop(this->s_, this->s_table_, t, LIR);
-//             this->s_size_++;  // N_HIR -> LIR
-//             if (current_prop() > this->prop) {
-//                 // 如果LIR缓存满了，从S挪动一个到Q
-//                 this->s_size_--;  // 挪动保证数量-1
-//                 auto back = this->s_.back();
-//                 this->s_table_.erase(back.value);
-//                 this->q_.push_front({back.value, R_HIR});
-//             }
-//             this->pruning(this->s_, this->s_table_);  // 减
-//             // TODO:Q满了淘汰Q，由于是手动逐出了，因此不需要这个东西了
-//             return;
-//         }
-
-//         auto it2 = this->q_table_.find(t);
-//         if (it2 != this->q_table_.end()) {  // hit R_HIR in Q
-//             auto node = it2->second;
-//             auto ins_it = this->s_table_.find(t);
-//             if (ins_it == this->s_table_.end()) {  // in Q but not in S
-//                 // push to Q front
-//                 this->s_.push_front({node->value, node->type});
-//                 this->s_table_[node->value] = this->s_.begin();
-//                 // push to Q front
-//                 this->q_.erase(it2->second);
-//                 this->q_.push_front({node->value, node->type});
-//                 this->q_table_[node->value] = this->q_.begin();
-//             } else {
-//                 this->moveToTop(this->s_, this->s_table_, t, LIR);  // push to S
-//                 this->q_.erase(it2->second);                        // erase from q
-//                 if (current_prop() > this->prop) {
-//                     // 如果LIR缓存满了，从S挪动一个到Q
-//                     this->s_size_--;  // 挪动保证数量-1
-//                     auto back = this->s_.back();
-//                     this->s_table_.erase(back.value);
-//                     this->q_.push_front({back.value, R_HIR});
-//                 }
-//                 this->pruning(this->s_, this->s_table_);  // 减
-//             }
-//             return;
-//         }
-
-//         // 同时写入S和Q的头部
-//         this->s_.push_front({t, R_HIR});
-//         this->s_table_[t] = this->s_.begin();
-//         this->q_.push_front({t, R_HIR});
-//         this->q_table_[t] = this->q_.begin();
-//         // 最大的难题，都是两部分缓存，缓存的容量很不好确定，循环依赖bug
-//     }
-
-//     [[nodiscard]] size_t size() const override { return 0; }
-
-//    private:
-//     // promote列表中的某个数据块到头部，并更新散列
-//     void moveToTop(std::list<Node> &list, std::unordered_map<int, typename std::list<Node>::iterator> &map,
-//                    const T &key, PageType type) {
-//         auto it = map.find(key);
-//         assert(it != map.end());  // 预期行为
-//         auto list_iter = it->second;
-//         list.erase(list_iter);
-//         list.push_front({key, type});
-//         map[key] = list.begin();
-//     }
-//     /*
-//      * 移除栈底部所有的非LIR元素(包括R_HIR / N_HIR)
-//      */
-//     void pruning(std::list<Node> &list, std::unordered_map<int, typename std::list<Node>::iterator> &map) {
-//         printf("Pruning");
-//         while (!list.empty()) {
-//             auto back = list.back();
-//             /*if (back.type == R_HIR || back.type == N_HIR) {*/
-//             if (back.type == N_HIR) {  // 原论文是两种都要删除，这里只删一种是为了不一致
-//                 map.erase(back.value);
-//                 list.pop_back();
-//                 if (back.type == R_HIR) {
-//                     this->s_size_--;
-//                 }
-//             } else {
-//                 break;
-//             }
-//         }
-//     }
-
-//     // 当前LIR缓存 占当前总缓存的比例
-//     double current_prop() {
-//         return static_cast<double>(this->s_size_) / static_cast<double>(this->s_size_ + this->q_.size());
-//     }
-
-//     std::list<Node> s_;
-//     std::unordered_map<int, typename std::list<Node>::iterator> s_table_;
-//     std::list<Node> q_;
-//     std::unordered_map<int, typename std::list<Node>::iterator> q_table_;
-//     size_t s_size_{0};  // 记录L中HIR 和 R_HIR中的数量
-//     double prop{0.1};
-// };
-
-// template <typename T>
-// class TwoQPolicy : public AbstractCachePolicy<T> {
-//    public:
-//     T oldest() override {
-//         Assert(this->lru_.size() == this->lru_table_.size(), "Inconsistent LRU Data");
-//         Assert(this->fifo_.size() == this->fifo_table_.size(), "Inconsistent FIFO Data");
-//         Assert(!(this->lru_.empty() && this->fifo_table_.empty()), "Empty data_block content");
-//         double lru_prop =
-//             static_cast<double>(this->lru_.size()) / static_cast<double>(this->lru_.size() + this->fifo_.size());
-//         if (lru_prop > this->lru_prop_) {
-//             Assert(!lru_.empty(), "Empty LRU");
-//             return this->lru_.back();
-//         } else {
-//             Assert(!fifo_.empty(), "Empty FIFO");
-//             return this->fifo_.back();
-//         }
-//     }
-//     void promote(T t) override {}
-//     void evict(T t) override {
-//         if (this->lru_table_.count(t)) {
-//             Assert(!lru_.empty() && lru_.back() == t, "Evict: Invalid cache content");
-//             this->lru_table_.erase(t);
-//             this->lru_.pop_back();
-//         } else {
-//             Assert(!fifo_.empty() && fifo_.back() == t, "Evict: Invalid cache content");
-//             this->fifo_table_.erase(t);
-//             this->fifo_.pop_back();
-//         }
-//     }
-
-//     void insert(T t) override {
-//         auto it = this->fifo_table_.find(t);
-//         if (it != this->fifo_table_.end()) {
-//             // hit fifo
-//             Assert(!lru_table_.count(t), "Insert duplicated Content");
-//             // insert into lru
-//             this->lru_.push_front(t);
-//             this->lru_table_[t] = this->lru_.begin();
-//             this->fifo_.erase(it->second);
-//             this->fifo_table_.erase(it);
-//             return;
-//         }
-
-//         auto it2 = this->lru_table_.find(t);
-//         if (it2 != this->lru_table_.end()) {
-//             this->lru_.erase(it2->second);
-//             this->lru_.push_front(t);
-//             this->lru_table_[t] = this->lru_.begin();
-//             return;
-//         }
-//         // not hit
-//         this->fifo_.push_front(t);
-//         this->fifo_table_[t] = this->fifo_.begin();
-//     }
-//     std::list<T> fifo_;
-//     std::unordered_map<T, typename std::list<T>::iterator> fifo_table_;
-//     std::list<T> lru_;
-//     std::unordered_map<T, typename std::list<T>::iterator> lru_table_;
-//     double lru_prop_{0.5};
-//     [[nodiscard]] size_t size() const override { return this->fifo_.size() + this->lru_.size(); }
-// };
+/**
+ * CLOCK-Pro (Jiang et al., USENIX ATC'05). Resident hot and cold pages and non-resident cold pages in their test
+ * period share one clock. A hit only sets the reference bit. HAND_cold picks the victim among cold pages and turns a
+ * referenced cold page hot, HAND_hot turns unreferenced hot pages cold and ends test periods it passes, and HAND_test
+ * bounds the non-resident pages. The cold target starts at its minimum, a hit on a page in its test period grows it
+ * and an expired test period shrinks it.
+ * The clock is a circular list on a flat slot array with slot 0 as the sentinel that every hand skips.
+ */
+template <typename T>
+class ClockProPolicy : public AbstractCachePolicy<T> {
+    static constexpr uint32_t HEAD = 0;
+    static constexpr size_t MIN_COLD = 1;
+    // oldests() looks at most this many slots per requested key: in a mostly hot clock the unreferenced cold pages are
+    // few and far apart, and a whole lap would cost O(N) per eviction
+    static constexpr size_t SCAN_STEPS = 8;
+    enum PageType : uint8_t { HOT = 0, COLD = 1, TEST = 2 };  // TEST: non-resident cold page in its test period
+    struct Slot {
+        T key{};
+        uint32_t prev{HEAD};
+        uint32_t next{HEAD};
+        PageType type{COLD};
+        bool ref{false};
+    };
+
+   public:
+    ClockProPolicy() : slots_(1) {}
+
+    // runs the hands until HAND_cold points at an unreferenced cold page
+    T oldest() override { return this->slots_[this->victim()].key; }
+
+    std::vector<T> oldests(size_t n) override {
+        std::vector<T> res;
+        if (this->size() == 0) return res;
+        const auto first = this->victim();
+        res.reserve(std::min(n, this->size()));
+        const auto max_steps = SCAN_STEPS * n;
+        auto i = first;
+        size_t steps = 0;
+        do {
+            const auto &s = this->slots_[i];
+            if (s.type == COLD && !s.ref) res.push_back(s.key);
+            i = this->next(i);
+        } while (i != first && res.size() < n && ++steps < max_steps);
+        return res;
+    }
+
+    void promote(T t) override {
+        const auto i = this->index_.find(t);
+        if (i == FlatIndexMap<T>::NONE || this->slots_[i].type == TEST) return;
+        this->slots_[i].ref = true;
+    }
+
+    void evict(T t) override {
+        const auto i = this->index_.find(t);
+        if (i == FlatIndexMap<T>::NONE) return;
+        auto &s = this->slots_[i];
+        if (s.type == COLD) {
+            // keep the metadata for its test period
+            s.type = TEST;
+            s.ref = false;
+            this->count_cold_--;
+            this->count_test_++;
+            while (this->count_test_ > 0 && this->count_hot_ + this->count_test_ > this->capacity_) {
+                this->runHandTest();
+            }
+        } else if (s.type == HOT) {
+            this->count_hot_--;
+            this->remove(i);
+        }
+    }
+
+    void insert(T t) override {
+        const auto i = this->index_.find(t);
+        if (i != FlatIndexMap<T>::NONE && this->slots_[i].type != TEST) return;
+        // still warming up, the capacity is the largest resident set seen so far
+        if (this->size() + 1 > this->capacity_) this->capacity_ = this->size() + 1;
+        if (i != FlatIndexMap<T>::NONE) {
+            // re-accessed during its test period
+            this->cold_target_ = std::min(this->cold_target_ + 1, this->capacity_);
+            this->count_test_--;
+            this->remove(i);
+            this->add(t, HOT);
+            this->count_hot_++;
+        } else {
+            this->add(t, COLD);
+            this->count_cold_++;
+        }
+        while (this->count_hot_ > this->capacity_ - this->cold_target_) this->runHandHot();
+    }
+
+    void admit(T t) override { this->insert(t); }
+
+    [[nodiscard]] size_t size() const override { return this->count_hot_ + this->count_cold_; }
+
+   private:
+    uint32_t victim() {
+        Assert(this->size() > 0, "Oldest: empty CLOCK-Pro policy");
+        while (true) {
+            while (this->count_cold_ == 0) this->runHandHot();
+            this->hand_cold_ = this->skipHead(this->hand_cold_);
+            auto &s = this->slots_[this->hand_cold_];
+            if (s.type == COLD) {
+                if (!s.ref) return this->hand_cold_;
+                s.ref = false;
+                s.type = HOT;
+                this->count_cold_--;
+                this->count_hot_++;
+                this->hand_cold_ = this->next(this->hand_cold_);
+                while (this->count_hot_ > this->capacity_ - this->cold_target_) this->runHandHot();
+            } else {
+                this->hand_cold_ = this->next(this->hand_cold_);
+            }
+        }
+    }
+
+    void runHandHot() {
+        this->hand_hot_ = this->skipHead(this->hand_hot_);
+        const auto i = this->hand_hot_;
+        auto &s = this->slots_[i];
+        if (s.type == HOT) {
+            if (s.ref) {
+                s.ref = false;
+            } else {
+                s.type = COLD;
+                this->count_hot_--;
+                this->count_cold_++;
+            }
+        } else if (s.type == TEST) {
+            this->expire(i);
+            return;
+        }
+        this->hand_hot_ = this->next(i);
+    }
+
+    void runHandTest() {
+        this->hand_test_ = this->skipHead(this->hand_test_);
+        const auto i = this->hand_test_;
+        if (this->slots_[i].type == TEST) {
+            this->expire(i);
+        } else {
+            this->hand_test_ = this->next(i);
+        }
+    }
+
+    // the test period ended without a re-access
+    void expire(uint32_t i) {
+        this->remove(i);
+        this->count_test_--;
+        if (this->cold_target_ > MIN_COLD) this->cold_target_--;
+    }
+
+    [[nodiscard]] inline uint32_t next(uint32_t i) const { return this->skipHead(this->slots_[i].next); }
+
+    [[nodiscard]] inline uint32_t skipHead(uint32_t i) const { return i == HEAD ? this->slots_[HEAD].next : i; }
+
+    // new pages go to the list head, right behind HAND_hot
+    void add(T t, PageType type) {
+        uint32_t i;
+        if (!this->free_.empty()) {
+            i = this->free_.back();
+            this->free_.pop_back();
+        } else {
+            i = static_cast<uint32_t>(this->slots_.size());
+            this->slots_.emplace_back();
+        }
+        auto &s = this->slots_[i];
+        s.key = t;
+        s.type = type;
+        s.ref = false;
+        const auto next = this->hand_hot_;
+        const auto prev = this->slots_[next].prev;
+        s.prev = prev;
+        s.next = next;
+        this->slots_[prev].next = i;
+        this->slots_[next].prev = i;
+        this->index_.put(t, i);
+    }
+
+    void remove(uint32_t i) {
+        auto &s = this->slots_[i];
+        for (auto hand : {&this->hand_cold_, &this->hand_hot_, &this->hand_test_}) {
+            if (*hand == i) *hand = s.next;
+        }
+        this->slots_[s.prev].next = s.next;
+        this->slots_[s.next].prev = s.prev;
+        this->index_.erase(s.key);
+        this->free_.push_back(i);
+    }
+
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> free_;
+    FlatIndexMap<T> index_;
+    uint32_t hand_cold_{HEAD}, hand_hot_{HEAD}, hand_test_{HEAD};
+    size_t count_hot_{0}, count_cold_{0}, count_test_{0};
+    size_t capacity_{0};
+    size_t cold_target_{MIN_COLD};
+};
 
 #endif
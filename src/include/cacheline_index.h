@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <list>
 #include <map>
+#include <set>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -15,27 +16,104 @@
 #include "utils.h"
 
 using cacheline_id_t = uint64_t;
+
+// FP index entry / external address of a block kept in the shared block store (Config::dedup_layout = shared)
+constexpr cacheline_id_t SHARED_STORE_ID = static_cast<cacheline_id_t>(-2);
+
+// Cachelines that reference one block stored in another cacheline
+struct BlockUsers {
+    uint32_t len{0};  // compressed length of the block, the bytes to migrate if its cacheline is evicted
+    std::vector<cacheline_id_t> users;
+};
+
 struct CachelineIndexData {
+    cacheline_id_t id_ = 0;  // set before the cacheline is first written
     size_t time_stamp_ = 0;
+    size_t data_bytes_ = 0;  // compressed bytes of the blocks stored in the cacheline
+    size_t live_bytes_ = 0;  // of which an LBA still maps to and the fp index still points here
     std::vector<addr_t> allocation_pages_;
     std::unordered_set<addr_t> external_refs_;
+    // Reverse reference graph: comp fp of a block stored here -> cachelines that reference it
+    std::unordered_map<fp_t, BlockUsers> block_refs_;
+    // Blocks in the shared block store this cacheline holds a reference to
+    std::vector<fp_t> shared_blocks_;
 };
 
+// Non-owning handles to cacheline metadata that lives inside the index, kept sorted by cacheline id.
+// A handle stays valid until its cacheline is removed from the index.
+using CachelineRefList = std::vector<std::pair<cacheline_id_t, CachelineIndexData *>>;
+
 class CachelineIndex {
    public:
     CachelineIndex();
-    std::pair<cacheline_id_t, CachelineIndexData> fetchOldestCacheline();
+    // Choose up to `n` victims (at least one), they leave the eviction window but stay in the index until removed
+    void fetchOldestCachelines(size_t n, CachelineRefList &victims);
     void remove(cacheline_id_t id);
     bool query(cacheline_id_t id, CachelineIndexData &data, bool promote);
+    // Zero-copy lookup, returns nullptr if the cacheline does not exist
+    CachelineIndexData *find(cacheline_id_t id, bool promote);
+    // Collect handles of all cachelines (still in the index, except the victims) that reference one of the victims
+    void collectRefs(const CachelineRefList &victims, CachelineRefList &refs);
     void insert(cacheline_id_t id, const CachelineIndexData &data, bool promote);
 
-    void addRefToCacheline(cacheline_id_t id, cacheline_id_t ref, bool promote);
+    // Up to `n` cachelines whose live fraction u is below Config::cache_policy.gc_threshold, in ascending order of the
+    // LFS cost-benefit (1 - u) * age / (1 + u) so the best one is at the back. Age is counted in cachelines written
+    // since, `now` is the newest id. Only the cachelines passed to updateUtilization are looked at.
+    void cleaningCandidates(cacheline_id_t now, size_t n, std::vector<cacheline_id_t> &candidates);
+
+    // Called when the live fraction of a cacheline may have dropped: a new cacheline, a dead block, a rewrite
+    void updateUtilization(cacheline_id_t id, const CachelineIndexData &data);
+
+    void addRefToCacheline(cacheline_id_t id, cacheline_id_t ref, fp_t comp_fp, uint32_t len, bool promote);
+
+    // Every cacheline, the next victim of the replacement policy first
+    void evictionOrder(std::vector<cacheline_id_t> &ids) const;
+
+    [[nodiscard]] size_t size() const { return this->data_.size(); }
 
     ~CachelineIndex() { delete this->policy_; }
 
    private:
+    struct WindowEntry {
+        size_t refs;
+        size_t rank;  // position in eviction order when the window was filled, 0 is the oldest
+    };
+
+    struct ScoredCandidate {
+        double cost;
+        size_t migration_bytes;
+        size_t fan_in;
+        cacheline_id_t id;
+        CachelineIndexData *data;
+    };
+
+    void refillEvictWindow(size_t window);
+    void leaveEvictWindow(cacheline_id_t id);
+    // Weighted cost of evicting a cacheline, see Config::cache_policy
+    size_t evictFanIn(const CachelineIndexData &data) const;
+    double evictCost(const CachelineIndexData &data, size_t rank, size_t fan_in, size_t max_fan_in,
+                     size_t &migration_bytes) const;
+    void fetchCheapestCachelines(size_t n, CachelineRefList &victims);
+
     AbstractCachePolicy<cacheline_id_t> *policy_;
     std::unordered_map<cacheline_id_t, CachelineIndexData> data_;
+
+    // Eviction candidates: the oldest cachelines ordered by (ref count, id). A cacheline leaves the window when it is
+    // promoted or removed, and the window is refilled from the policy once half of it has been consumed, so choosing
+    // a victim costs O(log k) plus an amortized O(1) share of the O(k) refill.
+    // The scored mode evaluates every candidate in the window instead.
+    const size_t evict_window_;
+    size_t window_width_{0};  // evict_window_, or wider while batches larger than half of it are evicted
+    const bool scored_;
+    std::set<std::pair<size_t, cacheline_id_t>> window_;
+    std::unordered_map<cacheline_id_t, WindowEntry> window_refs_;
+    std::vector<ScoredCandidate> scored_candidates_;  // reused by every scored eviction
+
+    // Cleaning candidates: the cachelines that went below the threshold, dropped once they are above it again or
+    // removed, so a scan costs nothing while no cacheline qualifies
+    const double gc_threshold_;
+    std::unordered_set<cacheline_id_t> cleanable_;
+    std::vector<std::pair<double, cacheline_id_t>> cleaning_scores_;  // reused by every scan
 };
 
 #endif  // CDCACHE_CACHELINE_INDEX_H
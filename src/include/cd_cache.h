@@ -1,7 +1,11 @@
 #ifndef CDCACHE_CD_CACHE_H
 #define CDCACHE_CD_CACHE_H
 
+#include <condition_variable>
 #include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #include "abstract_cache.h"
 #include "block_detector.h"
@@ -27,23 +31,90 @@ class CDCache : public AbstractCache {
     void open(const std::string &name, size_t size);
 
    private:
+    // read() and write() lock `mutex_`, the functions below expect it to be held
+    bool writeBlock(const DataBlock &data_block, bool read_miss, std::unique_lock<std::mutex> &lock);
+
     void detecteBlockType(std::vector<DataBlock> &data_blocks);
 
-    void evictOne(addr_t id, const CachelineIndexData &data);
+    void rebuildDetector();
+
+    // The detector holds each raw fp once for all the fp index entries storing it, it is removed with the last one
+    void holdDetectorKey(fp_t raw_fp);
+    void releaseDetectorKey(fp_t raw_fp);
+
+    void evict(size_t n);
+
+    void removeVictims();
 
     void updateLBAIndex(std::vector<DataBlock> &data_blocks);
 
+    // Live bytes of the cachelines, a stored block is live while an LBA maps to it
+    void addLbaRef(fp_t comp_fp, uint32_t len);
+    void dropLbaRef(fp_t comp_fp);
+    // Add (sign > 0) or remove the bytes of a live block from the cacheline the fp index points to
+    void accountLive(fp_t comp_fp, int sign);
+
+    // Compact a mostly dead cacheline (Config::cache_policy.gc_threshold), or reclaim a segment of a log-structured
+    // device (Config::device_layout). Return false if nothing frees a page
+    bool clean();
+
+    bool reclaimSegment();
+
+    // Read a hit from the cache device (Config::read_from_device), `data` is null for a block in the shared store
+    void fetchBlock(fp_t comp_fp, const CachelineIndexData *data, LogicalBlock &block);
+
     size_t dedupBlocks(std::vector<DataBlock> &data_blocks);
 
-    bool flushBuffer();
+    bool flushBuffer(std::unique_lock<std::mutex> &lock);
+
+    // Block until the reclaimer has freed `need` pages
+    void waitForSpace(size_t need, std::unique_lock<std::mutex> &lock);
+
+    void reclaimLoop();
+
+    // Warm restart (Config::warm_restart): at shutdown a checkpoint with a superblock, the pages of every cacheline
+    // and shared block and the LBA index is written next to the cache device. At start-up the fp index, the reference
+    // graph and the detector are rebuilt from it and the cacheline metadata scanned from the device.
+    void checkpoint();
+
+    // Return false (cold start) if there is no usable checkpoint
+    bool restore();
 
     DataBlockBuffer data_block_buffer_{globalEnv().c.data_block_buffer_size};
     AbstractBlockDetector *detector_;
+    std::unordered_map<fp_t, uint32_t> detector_refs_;  // raw fp -> fp index entries
     SSDProxy *proxy_{nullptr};
     // Indexes
     AbstractFPIndex *fp_index_{nullptr};
     AbstractLBAIndex *lba_index_{nullptr};
     CachelineIndex cacheline_index_;
+    // Config::dedup_layout: blocks referenced by several cachelines live in the shared block store of the proxy
+    const bool shared_layout_{globalEnv().c.dedup_layout == "shared"};
+    struct LiveBlock {
+        uint32_t lba_refs;
+        uint32_t len;  // compressed length
+    };
+    std::unordered_map<fp_t, LiveBlock> lba_refs_;  // comp fp -> LBAs mapping to it
+    cacheline_id_t newest_cacheline_{0};
+    // cleaning candidates kept from one scan of the cacheline index, the best one at the back
+    static constexpr size_t GC_SCAN = 16;
+    std::vector<cacheline_id_t> gc_candidates_;
+    std::vector<fp_t> gc_dropped_;
+    CachelineRefList evict_victims_;  // reused by every eviction to avoid allocation
+    CachelineRefList evict_users_;
+    PageBuffer read_buffer_;  // whole cacheline read by fetchBlock
+    std::string checkpoint_path_;
+
+    // Background eviction (Config::cache_policy.background_evict): the reclaimer wakes up when free pages drop below
+    // the low watermark and evicts until they reach the high one, so a flush only waits when it falls behind
+    std::mutex mutex_;
+    std::condition_variable reclaim_cv_;  // wakes the reclaimer
+    std::condition_variable space_cv_;    // wakes a flush waiting for free pages
+    std::thread reclaimer_;
+    bool stop_{false};
+    size_t low_mark_{0};      // in pages
+    size_t high_mark_{0};     // in pages
+    size_t waiting_need_{0};  // pages a stalled flush is waiting for
 };
 
 #endif  // CDCACHE_CD_CACHE_H
@@ -10,6 +10,7 @@
 #include <stdexcept>
 #include <string>
 
+#include "block_detector.h"
 #include "cache_policy.h"
 #include "deletable_bloom_filter.h"
 #include "nlohmann/json.hpp"
@@ -27,6 +28,8 @@ struct Stat {
     // for cdcache
     uint64_t read_lose_by_lba{0};
     uint64_t read_lose_by_fp{0};
+    uint64_t read_device_blocks{0};  // hits fetched from the cache device (Config::read_from_device)
+    uint64_t read_page_read{0};      // pages read for them
     // compression_ratio
     uint64_t raw_data{0};  // The total size of data involved in compression = block size * write_ctr
     uint64_t compressed_data{0};
@@ -36,7 +39,68 @@ struct Stat {
     uint64_t page_write{0};  // The number of pages written to the cache block device (slightly larger than the total
                              // compressed data size due to metadata and padding)
 
+    uint64_t device_write_ios{0};  // write requests issued to the cache device after coalescing contiguous pages
+    uint64_t device_read_ios{0};
+    uint64_t device_read_pages{0};
+    // page allocator
+    uint64_t alloc_requests{0};
+    uint64_t alloc_extents{0};         // contiguous runs of pages handed out
+    uint64_t alloc_split_requests{0};  // requests no free extent could hold (extent allocator)
+    uint64_t alloc_free_pages{0};      // free space of the extent allocator, as of the last operation
+    uint64_t alloc_free_extents{0};
+    uint64_t alloc_free_extents_max{0};
+    uint64_t alloc_largest_free_extent{0};
+    // log-structured layout
+    uint64_t segment_writes{0};         // sequential segment writes
+    uint64_t segment_page_write{0};     // pages written by them
+    uint64_t segment_padding_pages{0};  // pages left unused at the end of sealed segments
+    uint64_t segment_cleaned{0};
+    uint64_t segment_evicted{0};  // segments reclaimed by evicting their cachelines
+    uint64_t segment_clean_pages{0};  // live pages moved out of cleaned segments
+
     uint64_t evict_refs{0};  //
+    // eviction cost
+    static constexpr size_t EVICT_COST_BUCKETS = 10;
+    uint64_t evict_scored{0};  // victims chosen by the scored mode
+    double evict_cost{0};      // sum of their costs
+    double evict_cost_max{0};
+    uint64_t evict_cost_hist[EVICT_COST_BUCKETS]{};  // costs relative to the sum of the weights, in equal buckets
+    uint64_t evict_predicted_migration_bytes{0};
+    uint64_t evict_migrated_bytes{0};  // blocks appended to referencing cachelines
+    uint64_t evict_page_write{0};      // pages rewritten in referencing cachelines
+    uint64_t evict_rewrites{0};        // referencing cachelines rewritten
+    uint64_t evict_patches{0};         // of which only the metadata and the appended data were written
+    uint64_t evict_batches{0};
+    uint64_t evict_page_read{0};       // pages read from the victims
+    uint64_t evict_metadata_reads{0};  // victims of which only the metadata was read
+    // lazy reference repair
+    uint64_t relocation_entries{0};            // blocks moved by eviction with a relocation entry
+    uint64_t relocation_entries_max{0};        // peak size of the relocation table
+    uint64_t relocation_repaired{0};           // stale references fixed while a cacheline was rewritten or evicted
+    uint64_t relocation_deferred_rewrites{0};  // referencing cachelines not rewritten by an eviction
+    // shared block store
+    uint64_t shared_promotions{0};  // blocks moved into the store
+    uint64_t shared_page_write{0};
+    uint64_t shared_pages{0};  // pages held by the store
+    uint64_t shared_pages_max{0};
+    uint64_t shared_bytes{0};  // compressed bytes held by the store
+    // dead data and the cleaner
+    uint64_t evict_stored_bytes{0};  // bytes stored in evicted cachelines
+    uint64_t evict_dead_bytes{0};    // of which no LBA mapped to any more
+    uint64_t gc_compactions{0};
+    uint64_t gc_pages_freed{0};
+    uint64_t gc_page_write{0};
+    uint64_t gc_bytes_dropped{0};
+    uint64_t gc_blocks_dropped{0};  // dead blocks removed from the fp index
+    // background eviction
+    uint64_t background_evict{0};  // eviction batches run by the reclaimer
+    uint64_t evict_stalls{0};      // flushes that had to wait for the reclaimer
+    // warm restart
+    uint64_t restart_cachelines{0};  // cachelines restored from the checkpoint
+    uint64_t restart_blocks{0};      // fp index entries rebuilt from their metadata
+    uint64_t restart_shared_blocks{0};
+    uint64_t restart_lbas{0};
+    uint64_t restart_page_read{0};  // metadata pages scanned
     // time break down
     uint64_t time_compression{0};
     uint64_t time_compression_lookup_table{0};
@@ -50,18 +114,47 @@ struct Stat {
     uint64_t time_evict{0};
     uint64_t time_evict_remove_cacheline{0};
     uint64_t time_evict_update_index{0};
+    uint64_t time_evict_stall{0};      // flushes blocked on eviction (evicting themselves or waiting)
+    uint64_t time_evict_stall_max{0};  // the longest of them
+    uint64_t time_background_evict{0};
+    uint64_t time_restart{0};  // rebuilding the indexes on a warm restart
     uint64_t time_update_cache_line_index{0};
 
     // promote info
     uint64_t promote_cacheline{0};
     uint64_t not_promote_cacheline{0};
 
+    // block detector accuracy: blocks that turned out to be unique after compression, split by the detector's guess
+    uint64_t detector_false_positive{0};
+    uint64_t detector_true_negative{0};
+    uint64_t detector_rebuild{0};
+    uint64_t detector_insert_failures{0};  // keys a full cuckoo filter could not place
+    uint64_t detector_capacity{0};
+    double detector_estimated_fp_rate{0};
+
     nlohmann::json toJson();
 };
 
 struct CachePolicy {
     std::string policy{"lfu"};
     std::string promote_policy{"no"};
+    size_t evict_window{5};  // number of oldest cachelines considered when choosing a victim
+    size_t evict_batch{1};   // victims evicted together, their referencing cachelines are rewritten once per batch
+    // eager: rewrite every cacheline referencing a moved block, lazy: record the move and repair on the next rewrite
+    std::string evict_repair{"eager"};
+    // refs: the least referenced cacheline in the window, scored: the one with the lowest weighted eviction cost
+    std::string evict_mode{"refs"};
+    double weight_age{1.0};
+    double weight_migration{1.0};
+    double weight_live{1.0};
+    double weight_refs{1.0};
+    // LFS style cleaner: before evicting, compact the cacheline with the best cost-benefit among those whose live
+    // fraction is below the threshold (0 disables it)
+    double gc_threshold{0};
+    // evict in a background thread between two free-space watermarks (fractions of the cache device)
+    bool background_evict{false};
+    double low_watermark{0.05};
+    double high_watermark{0.1};
 };
 
 class Config {
@@ -71,6 +164,11 @@ class Config {
 
     std::string primary_name;
     std::string cache_name;
+    // mem: simulated in DRAM, file: pread/pwrite on `cache_name`, uring: io_uring on `cache_name`
+    std::string cache_device{"mem"};
+    unsigned io_queue_depth{32};  // uring: requests in flight and registered write buffers
+    bool use_direct_io{false};    // file/uring: open `cache_name` with O_DIRECT, bypassing the page cache
+    bool warm_restart{false};     // file/uring: checkpoint the indexes at shutdown and rebuild them on the next start
     size_t primary_size{};
     size_t cache_size{};
     size_t data_block_buffer_size{8};
@@ -85,6 +183,20 @@ class Config {
     FILE *output{nullptr};    //
     nlohmann::json result_cache;
     std::string compression_method;
+    // cacheline: a block may copy from the blocks before it in the same flush; block: every block decodes on its own
+    std::string compression_scope{"cacheline"};
+    bool read_from_device{false};  // a read hit fetches the block from the cache device
+    std::string block_detector{"bloom"};  // bloom / blocked_bloom / cuckoo / set
+    double detector_fp_rate{0.01};        // target false-positive rate of filter based detectors
+    // inline: a duplicate references the block inside the cacheline that wrote it first (migrated on eviction)
+    // shared: a block referenced twice is moved into a refcounted shared block store
+    std::string dedup_layout{"inline"};
+    // stacked: pages one at a time, recycled last in first out; extent: contiguous extents with coalescing
+    std::string page_allocator{"stacked"};
+    // page: cachelines are written in place to the pages of the allocator, log: appended to segments (LFS)
+    std::string device_layout{"page"};
+    size_t segment_size{4 << 20};          // bytes, log layout
+    double segment_clean_threshold{0.3};  // live fraction below which a reclaimed segment is cleaned, not evicted
     CachePolicy cache_policy;
     bool use_cache = true;        //
     bool use_huffman = false;     //
@@ -116,23 +228,28 @@ struct Env {
     Env() {}
     ~Env() {}
 
+    static AbstractBlockDetector *detectorInstance();
+
     template <typename T>
     static AbstractCachePolicy<T> *policyInstance() {
-        return new LRUPolicy<T>();
-        // const auto policy = globalEnv().c.cache_policy.policy;
-        // if (policy == "lru") {
-        //     return new LRUPolicy<T>();
-        // } else if (policy == "lfu") {
-        //     return new LFUPolicy<T>();
-        // } else if (policy == "arc") {
-        //     return new ARCPolicy<T>();
-        // } else if (policy == "lirs") {
-        //     return new LIRSPolicy<T>();
-        // } else if (policy == "2q") {
-        //     return new TwoQPolicy<T>();
-        // } else {
-        //     throw std::runtime_error("Unknown Cache policy type: " + std::string(policy));
-        // }
+        const auto &policy = globalEnv().c.cache_policy.policy;
+        if (policy == "lru") {
+            return new LRUPolicy<T>();
+        } else if (policy == "lfu") {
+            return new LFUPolicy<T>();
+        } else if (policy == "arc") {
+            return new ARCPolicy<T>();
+        } else if (policy == "lirs") {
+            return new LIRSPolicy<T>();
+        } else if (policy == "2q") {
+            return new TwoQPolicy<T>();
+        } else if (policy == "s3fifo") {
+            return new S3FIFOPolicy<T>();
+        } else if (policy == "clockpro") {
+            return new ClockProPolicy<T>();
+        } else {
+            throw std::runtime_error("Unknown Cache policy type: " + policy);
+        }
     };
 };
 // Config &globalConfig();
@@ -0,0 +1,165 @@
+#ifndef CDCACHE_CUCKOO_FILTER_H
+#define CDCACHE_CUCKOO_FILTER_H
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "xxhash.h"
+
+/**
+ * Cuckoo filter (Fan et al., CoNEXT'14) with 4 slots per bucket and 16-bit tags.
+ * Unlike a bloom filter a key inserted once can always be deleted exactly, and the false-positive rate stays around
+ * 8 / 2^16 at full load. A bucket is one 64-bit word, so a lookup touches at most two words.
+ */
+class CuckooFilter {
+    static constexpr int SLOTS = 4;
+    static constexpr int MAX_KICKS = 500;
+    static constexpr uint64_t LANES_LOW = 0x0001000100010001ULL;
+    static constexpr uint64_t LANES_HIGH = 0x8000800080008000ULL;
+
+   public:
+    static constexpr int TAG_BITS = 16;
+    static constexpr double MAX_LOAD = 0.9;
+    // fixed so the kick-out choices, and with them the simulator's stats, are the same on every run
+    static constexpr uint64_t DEFAULT_SEED = 0x9e3779b97f4a7c15ULL;
+
+    CuckooFilter(size_t capacity, uint64_t seed) : seed_(seed), rng_(seed) {
+        size_t n = 1;
+        while (static_cast<double>(n) * SLOTS * MAX_LOAD < static_cast<double>(capacity)) n <<= 1;
+        this->buckets_.assign(n, 0);
+        this->mask_ = n - 1;
+    }
+
+    explicit CuckooFilter(size_t capacity) : CuckooFilter(capacity, DEFAULT_SEED) {}
+
+    // return false if the filter is full and the key could not be placed
+    bool insert(uint64_t value) {
+        if (this->has_victim_) return false;
+        size_t i;
+        uint16_t tag;
+        this->index(value, i, tag);
+        if (this->put(i, tag) || this->put(this->alt(i, tag), tag)) {
+            ++this->size_;
+            return true;
+        }
+        // kick out a random resident until everyone finds a place
+        if (this->rng_() & 1) i = this->alt(i, tag);
+        for (int n = 0; n < MAX_KICKS; n++) {
+            const auto lane = this->rng_() % SLOTS;
+            const auto old = static_cast<uint16_t>(this->buckets_[i] >> (16 * lane));
+            this->buckets_[i] ^= static_cast<uint64_t>(old ^ tag) << (16 * lane);
+            tag = old;
+            i = this->alt(i, tag);
+            if (this->put(i, tag)) {
+                ++this->size_;
+                return true;
+            }
+        }
+        this->has_victim_ = true;
+        this->victim_index_ = i;
+        this->victim_tag_ = tag;
+        ++this->size_;
+        return true;
+    }
+
+    bool remove(uint64_t value) {
+        size_t i;
+        uint16_t tag;
+        this->index(value, i, tag);
+        const auto i2 = this->alt(i, tag);
+        if (this->erase(i, tag) || this->erase(i2, tag)) {
+            --this->size_;
+            // the victim may fit now
+            if (this->has_victim_) {
+                this->has_victim_ = false;
+                --this->size_;
+                this->reinsertVictim();
+            }
+            return true;
+        }
+        if (this->has_victim_ && this->victim_tag_ == tag &&
+            (this->victim_index_ == i || this->victim_index_ == i2)) {
+            this->has_victim_ = false;
+            --this->size_;
+            return true;
+        }
+        return false;
+    }
+
+    [[nodiscard]] bool query(uint64_t value) const {
+        size_t i;
+        uint16_t tag;
+        this->index(value, i, tag);
+        const auto i2 = this->alt(i, tag);
+        if (this->has_victim_ && this->victim_tag_ == tag && (this->victim_index_ == i || this->victim_index_ == i2)) {
+            return true;
+        }
+        return match(this->buckets_[i], tag) != 0 || match(this->buckets_[i2], tag) != 0;
+    }
+
+    [[nodiscard]] bool full() const { return this->has_victim_; }
+
+    [[nodiscard]] size_t size() const { return this->size_; }
+
+    [[nodiscard]] double load() const {
+        return static_cast<double>(this->size_) / static_cast<double>(this->buckets_.size() * SLOTS);
+    }
+
+   private:
+    // lanes (16 bit) of `bucket` that hold `tag`, the lowest set bit is exact
+    static inline uint64_t match(uint64_t bucket, uint16_t tag) {
+        const auto x = bucket ^ (LANES_LOW * tag);
+        return (x - LANES_LOW) & ~x & LANES_HIGH;
+    }
+
+    inline void index(uint64_t value, size_t &i, uint16_t &tag) const {
+        const uint64_t h = XXH64(&value, sizeof(uint64_t), this->seed_);
+        i = h & this->mask_;
+        tag = static_cast<uint16_t>(h >> 48);
+        if (tag == 0) tag = 1;  // 0 marks an empty slot
+    }
+
+    [[nodiscard]] inline size_t alt(size_t i, uint16_t tag) const {
+        return (i ^ (static_cast<uint64_t>(tag) * 0xc6a4a7935bd1e995ULL)) & this->mask_;
+    }
+
+    inline bool put(size_t i, uint16_t tag) {
+        const auto empty = match(this->buckets_[i], 0);
+        if (empty == 0) return false;
+        const auto lane = __builtin_ctzll(empty) / 16;
+        this->buckets_[i] |= static_cast<uint64_t>(tag) << (16 * lane);
+        return true;
+    }
+
+    inline bool erase(size_t i, uint16_t tag) {
+        const auto m = match(this->buckets_[i], tag);
+        if (m == 0) return false;
+        const auto lane = __builtin_ctzll(m) / 16;
+        this->buckets_[i] &= ~(uint64_t{0xffff} << (16 * lane));
+        return true;
+    }
+
+    void reinsertVictim() {
+        auto i = this->victim_index_;
+        auto tag = this->victim_tag_;
+        if (this->put(i, tag) || this->put(this->alt(i, tag), tag)) {
+            ++this->size_;
+        } else {
+            this->has_victim_ = true;
+            ++this->size_;
+        }
+    }
+
+    uint64_t seed_;
+    std::mt19937 rng_;
+    std::vector<uint64_t> buckets_;
+    size_t mask_{0};
+    size_t size_{0};
+    // a tag that could not be placed after MAX_KICKS, the filter is full while it is set
+    bool has_victim_{false};
+    size_t victim_index_{0};
+    uint16_t victim_tag_{0};
+};
+
+#endif  // CDCACHE_CUCKOO_FILTER_H
@@ -2,42 +2,47 @@
 #define CDCACHE_DELETABLE_BLOOM_FILTER_H
 
 #include <array>
-#include <bitset>
+#include <cmath>
+#include <cstdint>
 #include <random>
+#include <vector>
 
 #include "xxhash.h"
 
-template <int N, int K>
+template <int K>
 class DeletableBloomFilter {
    public:
-    static_assert(N > 0 && (N & (N - 1)) == 0);
+    static constexpr int HASHES = K;
 
-    explicit DeletableBloomFilter(uint64_t seed) { this->initHashSeed(seed); }
-
-    DeletableBloomFilter() {
-        std::random_device rd;
-        this->initHashSeed(rd());
+    DeletableBloomFilter(size_t bits, uint64_t seed) : bits_(bits == 0 ? 1 : bits) {
+        this->initHashSeed(seed);
+        this->slots_.assign((this->bits_ + 63) / 64, 0);
+        this->collisions_.assign(this->slots_.size(), 0);
     }
 
+    explicit DeletableBloomFilter(size_t bits) : DeletableBloomFilter(bits, std::random_device{}()) {}
+
     // for test
     const std::array<int, K> &getHashSeeds() { return this->hash_seeds; }
 
     void insert(uint64_t value) {
         for (int i = 0; i < K; i++) {
-            auto v = XXH64(&value, sizeof(uint64_t), hash_seeds[i]) % N;
-            if (this->slots_[v]) {
-                this->collisions_.set(v);
+            auto v = XXH64(&value, sizeof(uint64_t), hash_seeds[i]) % bits_;
+            if (test(this->slots_, v)) {
+                set(this->collisions_, v);
             } else {
-                this->slots_.set(v);
+                set(this->slots_, v);
+                ++this->ones_;
             }
         }
     }
 
     void remove(uint64_t value) {
         for (int i = 0; i < K; i++) {
-            auto v = XXH64(&value, sizeof(uint64_t), hash_seeds[i]) % N;
-            if (!this->collisions_[v]) {
-                this->slots_.reset(v);
+            auto v = XXH64(&value, sizeof(uint64_t), hash_seeds[i]) % bits_;
+            if (!test(this->collisions_, v) && test(this->slots_, v)) {
+                this->slots_[v / 64] &= ~(uint64_t{1} << (v % 64));
+                --this->ones_;
             }
         }
     }
@@ -45,13 +50,21 @@ class DeletableBloomFilter {
     [[nodiscard]] bool query(uint64_t value) const {
         size_t num = 0;
         for (int i = 0; i < K; i++) {
-            auto v = XXH64(&value, sizeof(uint64_t), hash_seeds[i]) % N;
-            if (this->slots_[v]) ++num;
+            auto v = XXH64(&value, sizeof(uint64_t), hash_seeds[i]) % bits_;
+            if (test(this->slots_, v)) ++num;
         }
         return num == K;
     }
 
+    [[nodiscard]] size_t bits() const { return this->bits_; }
+
+    // fraction of set bits, the false-positive rate is about fill^K
+    [[nodiscard]] double fill() const { return static_cast<double>(this->ones_) / static_cast<double>(this->bits_); }
+
    private:
+    static inline bool test(const std::vector<uint64_t> &words, size_t v) { return (words[v / 64] >> (v % 64)) & 1; }
+    static inline void set(std::vector<uint64_t> &words, size_t v) { words[v / 64] |= uint64_t{1} << (v % 64); }
+
     void initHashSeed(int seed) {
         std::mt19937 gen(seed);
         std::uniform_int_distribution<> dis(1, 4 * K);
@@ -61,8 +74,17 @@ class DeletableBloomFilter {
     }
 
     std::array<int, K> hash_seeds;
-    std::bitset<N> slots_;
-    std::bitset<N> collisions_;
+    size_t bits_;
+    size_t ones_{0};
+    std::vector<uint64_t> slots_;
+    std::vector<uint64_t> collisions_;
 };
 
+// Number of bits a K-hash bloom filter needs to hold `capacity` keys at the given false-positive rate
+inline size_t bloomFilterBits(size_t capacity, int k, double fp_rate) {
+    const auto c = capacity == 0 ? 1 : capacity;
+    return static_cast<size_t>(std::ceil(-static_cast<double>(k) * static_cast<double>(c) /
+                                         std::log(1.0 - std::pow(fp_rate, 1.0 / k))));
+}
+
 #endif  // CDCACHE_DELETABLE_BLOOM_FILTER_H
@@ -2,6 +2,8 @@
 #define CDCACHE_DEVICE_H
 
 #include <cstdint>
+#include <memory>
+#include <vector>
 
 #include "utils.h"
 
@@ -9,6 +11,16 @@
 device interface and simulation
 */
 
+// One contiguous range of the device and the memory it is transferred to/from
+template <typename Byte>
+struct IoRun {
+    uint64_t addr;
+    Byte *buf;
+    uint32_t len;
+};
+using ReadRun = IoRun<uint8_t>;
+using WriteRun = IoRun<const uint8_t>;
+
 class AbstractBlockDevice {
    public:
     virtual ~AbstractBlockDevice();
@@ -16,6 +28,23 @@ class AbstractBlockDevice {
     virtual int read(uint64_t addr, uint8_t *buf, uint32_t len) = 0;
 
     virtual int write(uint64_t addr, const uint8_t *buf, uint32_t len) = 0;
+
+    // Scatter/gather I/O over several runs, return the total number of bytes transferred.
+    // The default issues one read/write per run.
+    virtual size_t readv(const std::vector<ReadRun> &runs);
+
+    virtual size_t writev(const std::vector<WriteRun> &runs);
+
+    // Start reading the runs and return the number of bytes requested, their memory must not be touched before
+    // waitReads. The default reads synchronously.
+    virtual size_t submitReads(const std::vector<ReadRun> &runs) { return this->readv(runs); }
+
+    // Wait until every read submitted so far is in
+    virtual void waitReads() {}
+
+    // A write may complete after it returns, wait until every write issued so far is on the device
+    virtual void drain() {}
+
     [[nodiscard]] inline virtual size_t size() const { return this->size_; }
 
     virtual bool open(const char *filename, uint64_t size) = 0;
@@ -80,4 +109,78 @@ class FileBlockDevice final : public AbstractBlockDevice {
     int fd_{-1};
 };
 
+/**
+ * File backed device driven by io_uring. A write is copied into one of `queue_depth` registered buffers and submitted
+ * without waiting, so it overlaps with the requests that follow; a buffer is reused once its write has completed. The
+ * runs of a read are submitted together and read straight into the caller's memory, after the in-flight writes they
+ * overlap have completed. readv returns once all of them are in, submitReads returns at once and leaves the wait to
+ * waitReads, so the reads also overlap with the caller's work. A short read is resubmitted for the remainder. A write
+ * waits for the in-flight reads and writes of its pages, io_uring does not order them.
+ */
+class UringBlockDevice final : public AbstractBlockDevice {
+   public:
+    static constexpr uint32_t SLOT_SIZE = 64 * 1024;  // bytes of one registered write buffer
+
+    explicit UringBlockDevice(unsigned queue_depth);
+
+    ~UringBlockDevice() override;
+
+    int read(uint64_t addr, uint8_t *buf, uint32_t len) override;
+
+    int write(uint64_t addr, const uint8_t *buf, uint32_t len) override;
+
+    size_t readv(const std::vector<ReadRun> &runs) override;
+
+    size_t writev(const std::vector<WriteRun> &runs) override;
+
+    size_t submitReads(const std::vector<ReadRun> &runs) override;
+
+    void waitReads() override;
+
+    void drain() override;
+
+    bool open(const char *filename, uint64_t size) override;
+
+   private:
+    struct Ring;  // the mapped submission and completion queues
+
+    struct Slot {
+        uint64_t addr;
+        uint32_t len;
+        bool busy;
+    };
+
+    // the part of a read that has not completed yet, `len` is 0 once it has
+    struct PendingRead {
+        uint64_t addr;
+        uint8_t *buf;
+        uint32_t len;
+    };
+
+    // queue one request, `tag` is a write slot or a read (READ_TAG | index in `reads_`) and comes back with its
+    // completion
+    void prepare(uint64_t tag);
+
+    // submit the queued requests and wait for at least `min_complete` completions
+    void enter(unsigned min_complete);
+
+    void reap();
+
+    [[nodiscard]] bool overlapsWrite(uint64_t addr, uint32_t len) const;
+
+    [[nodiscard]] bool overlapsRead(uint64_t addr, uint32_t len) const;
+
+    std::unique_ptr<Ring> ring_;
+    int fd_{-1};
+    unsigned depth_;
+    uint8_t *buffers_{nullptr};  // depth_ slots of SLOT_SIZE bytes
+    std::vector<Slot> slots_;
+    std::vector<int> free_slots_;
+    std::vector<PendingRead> reads_;  // depth_ entries
+    std::vector<int> free_reads_;
+    std::vector<int> short_reads_;  // completed partially, to be resubmitted
+    unsigned queued_{0};            // prepared but not submitted yet
+    unsigned reads_in_flight_{0};
+};
+
 #endif
@@ -0,0 +1,107 @@
+#ifndef CDCACHE_FLAT_INDEX_MAP_H
+#define CDCACHE_FLAT_INDEX_MAP_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * Open-addressing hash map from a key to a 32-bit slot index, used by the array-backed cache policies.
+ * Linear probing over a power-of-two table kept at most half full, erase shifts the following entries back so there
+ * are no tombstones. Nothing is allocated per key.
+ */
+template <typename T>
+class FlatIndexMap {
+    struct Entry {
+        T key{};
+        uint32_t value;
+    };
+
+   public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    explicit FlatIndexMap(size_t capacity = 16) {
+        size_t n = 16;
+        while (n < capacity * 2) n <<= 1;
+        this->table_.assign(n, Entry{T{}, NONE});
+        this->mask_ = n - 1;
+    }
+
+    // slot of `key`, or NONE
+    [[nodiscard]] inline uint32_t find(const T &key) const {
+        for (auto i = this->home(key);; i = (i + 1) & this->mask_) {
+            const auto &e = this->table_[i];
+            if (e.value == NONE) return NONE;
+            if (e.key == key) return e.value;
+        }
+    }
+
+    // insert `key` or overwrite its slot
+    void put(const T &key, uint32_t value) {
+        if ((this->size_ + 1) * 2 > this->table_.size()) this->grow();
+        for (auto i = this->home(key);; i = (i + 1) & this->mask_) {
+            auto &e = this->table_[i];
+            if (e.value == NONE) {
+                e.key = key;
+                e.value = value;
+                this->size_++;
+                return;
+            }
+            if (e.key == key) {
+                e.value = value;
+                return;
+            }
+        }
+    }
+
+    bool erase(const T &key) {
+        auto i = this->home(key);
+        while (true) {
+            const auto &e = this->table_[i];
+            if (e.value == NONE) return false;
+            if (e.key == key) break;
+            i = (i + 1) & this->mask_;
+        }
+        // backward shift: move up every following entry whose probe sequence passes the hole
+        for (auto j = (i + 1) & this->mask_; this->table_[j].value != NONE; j = (j + 1) & this->mask_) {
+            const auto k = this->home(this->table_[j].key);
+            const bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                this->table_[i] = this->table_[j];
+                i = j;
+            }
+        }
+        this->table_[i].value = NONE;
+        this->size_--;
+        return true;
+    }
+
+    [[nodiscard]] size_t size() const { return this->size_; }
+
+   private:
+    [[nodiscard]] inline size_t home(const T &key) const {
+        // std::hash of integers is the identity, mix it before masking
+        uint64_t h = std::hash<T>{}(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h & this->mask_;
+    }
+
+    void grow() {
+        std::vector<Entry> old;
+        old.swap(this->table_);
+        this->table_.assign(old.size() * 2, Entry{T{}, NONE});
+        this->mask_ = this->table_.size() - 1;
+        this->size_ = 0;
+        for (const auto &e : old) {
+            if (e.value != NONE) this->put(e.key, e.value);
+        }
+    }
+
+    std::vector<Entry> table_;
+    size_t mask_{0};
+    size_t size_{0};
+};
+
+#endif  // CDCACHE_FLAT_INDEX_MAP_H
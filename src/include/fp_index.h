@@ -1,6 +1,7 @@
 #ifndef CDCACHE_FPINDEX_H
 #define CDCACHE_FPINDEX_H
 
+#include <functional>
 #include <unordered_map>
 
 #include "utils.h"
@@ -23,6 +24,8 @@ class AbstractFPIndex {
 
     virtual size_t size() = 0;
 
+    virtual void forEach(const std::function<void(fp_t, const FPIndexData &)> &f) = 0;
+
     virtual ~AbstractFPIndex() = default;
 };
 
@@ -34,6 +37,7 @@ class SimpleFPIndex final : public AbstractFPIndex {
 
     bool remove(fp_t fp) override;
     size_t size() override;
+    void forEach(const std::function<void(fp_t, const FPIndexData &)> &f) override;
 
     ~SimpleFPIndex() override;
 
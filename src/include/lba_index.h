@@ -1,6 +1,7 @@
 #ifndef CDCACHE_LBA_INDEX_H
 #define CDCACHE_LBA_INDEX_H
 
+#include <functional>
 #include <unordered_map>
 
 #include "utils.h"
@@ -15,6 +16,8 @@ class AbstractLBAIndex {
 
     virtual bool remove(addr_t address) = 0;
 
+    virtual void forEach(const std::function<void(addr_t, fp_t)> &f) = 0;
+
     virtual ~AbstractLBAIndex() = default;
 };
 
@@ -26,6 +29,8 @@ class SimpleLBAIndex : public AbstractLBAIndex {
 
     bool remove(addr_t address) override;
 
+    void forEach(const std::function<void(addr_t, fp_t)> &f) override;
+
     ~SimpleLBAIndex() override = default;
 
    private:
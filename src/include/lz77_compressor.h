@@ -65,6 +65,7 @@ struct DataBlockSlice {
     int begin{0};
     int end{-1};
     bool dup{false};
+    bool isolated{false};  // Config::compression_scope = block, matches stay inside the block
     size_t pair_size{0};
     std::vector<LZ77Pair> pairs;
     std::vector<byte_t> compressed_data;
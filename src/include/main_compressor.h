@@ -15,6 +15,9 @@ class MainCompressor {
 
     static void decompress(std::vector<DataBlock> &dataBlocks, bool useHuffman);
 
+    // decode one block compressed with Config::compression_scope = block
+    static std::vector<byte_t> decompressBlock(const std::vector<byte_t> &compData);
+
     // compress byte array
     static std::vector<LZ77Pair> lz77CompressByteArray(const std::vector<byte_t> &bytes);
     static std::vector<byte_t> lz77DecompressByteArray(const std::vector<LZ77Pair> &pairs);
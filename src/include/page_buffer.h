@@ -0,0 +1,43 @@
+#ifndef CDCACHE_PAGE_BUFFER_H
+#define CDCACHE_PAGE_BUFFER_H
+
+#include <cstdlib>
+#include <memory>
+
+#include "utils.h"
+
+/**
+ * Growable byte buffer aligned to 4 KiB, so it can be handed to an O_DIRECT device as is (Config::use_direct_io). The
+ * uring device still copies a write out of it into a registered buffer, since the write outlives the call. It only
+ * grows, so a buffer reused for every cache line stops allocating once it has seen the largest one. Move-only, views
+ * into it stay valid across a move.
+ */
+class PageBuffer {
+   public:
+    static constexpr size_t ALIGNMENT = 4096;
+
+    // make room for `len` bytes, the content is lost if the buffer has to grow
+    byte_t *resize(size_t len) {
+        if (len > this->capacity_) {
+            this->capacity_ = (len + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            this->data_.reset(static_cast<byte_t *>(std::aligned_alloc(ALIGNMENT, this->capacity_)));
+            Assert(this->data_ != nullptr, "Can not allocate %zu bytes page buffer", this->capacity_);
+        }
+        this->size_ = len;
+        return this->data_.get();
+    }
+
+    [[nodiscard]] byte_t *data() { return this->data_.get(); }
+    [[nodiscard]] const byte_t *data() const { return this->data_.get(); }
+    [[nodiscard]] size_t size() const { return this->size_; }
+
+   private:
+    struct Free {
+        void operator()(byte_t *p) const { std::free(p); }
+    };
+    std::unique_ptr<byte_t, Free> data_;
+    size_t size_{0};
+    size_t capacity_{0};
+};
+
+#endif  // CDCACHE_PAGE_BUFFER_H
@@ -3,7 +3,9 @@
 
 #include <bitset>
 #include <cstdint>
+#include <map>
 #include <memory_resource>
+#include <set>
 #include <vector>
 
 #include "utils.h"
@@ -19,9 +21,14 @@ class AbstractPageManager {
 
     virtual size_t free_blocks() = 0;
 
+    [[nodiscard]] size_t total_blocks() const { return this->size_; }
+
     virtual ~AbstractPageManager() = default;
 
    protected:
+    // count the request and the contiguous extents of blocks[first:] it was served with
+    static void recordAllocation(const std::vector<addr_t> &blocks, size_t first, bool split);
+
     const std::size_t size_;
 };
 
@@ -46,4 +53,86 @@ class StackedDiscretePageManager : public AbstractPageManager {
     std::vector<size_t> recycled_;
 };
 
+/**
+ * Keep the free space as extents, indexed by address to coalesce neighbours on reclaim and by length to serve a
+ * request from the shortest extent that holds it (lowest address first). A request no single extent can hold is
+ * served from the longest extents. Fragmentation of the free space is reported in Stat.
+ */
+class ExtentPageManager : public AbstractPageManager {
+   public:
+    explicit ExtentPageManager(size_t size);
+    bool allocate(size_t len, std::vector<addr_t> &blocks) override;
+    bool reclaim(addr_t blockAddress) override;
+
+    size_t free_blocks() override;
+    ~ExtentPageManager() override = default;
+
+    [[nodiscard]] size_t free_extents() const { return this->by_addr_.size(); }
+    [[nodiscard]] size_t largest_free_extent() const {
+        return this->by_size_.empty() ? 0 : this->by_size_.rbegin()->first;
+    }
+
+   private:
+    // hand out the first `len` pages of the free extent starting at `begin`
+    void take(addr_t begin, size_t len, std::vector<addr_t> &blocks);
+    void insert_extent(addr_t begin, size_t len);
+    void erase_extent(std::map<addr_t, size_t>::iterator it);
+    void updateStat() const;
+
+    std::map<addr_t, size_t> by_addr_;              // begin -> length
+    std::set<std::pair<size_t, addr_t>> by_size_;  // (length, begin)
+    size_t free_blocks_{0};
+};
+
+/**
+ * Log-structured allocation (Config::device_layout = log). The device is split into segments of `segment_pages`
+ * pages and every request is appended to the open segment, so a request never spans two segments. A reclaimed page
+ * is not reused until its whole segment is free again, moving the live data out of mostly dead segments is left to
+ * the cleaner of SSDProxy. free_blocks() leaves out RESERVED_SEGMENTS free segments for the cleaner and for the
+ * cachelines rewritten by an eviction, which are written before the eviction frees anything.
+ */
+class SegmentPageManager : public AbstractPageManager {
+   public:
+    static constexpr size_t RESERVED_SEGMENTS = 2;
+
+    SegmentPageManager(size_t size, size_t segment_pages);
+    bool allocate(size_t len, std::vector<addr_t> &blocks) override;
+    bool reclaim(addr_t blockAddress) override;
+
+    size_t free_blocks() override;
+    ~SegmentPageManager() override = default;
+
+    [[nodiscard]] size_t segment_pages() const { return this->segment_pages_; }
+    [[nodiscard]] size_t segments() const { return this->segments_.size(); }
+    [[nodiscard]] size_t segment_of(addr_t addr) const { return addr / this->segment_pages_; }
+    [[nodiscard]] size_t free_segments() const { return this->free_.size(); }
+    // free pages including the reserved segments
+    [[nodiscard]] size_t unused_pages() const {
+        return this->free_.size() * this->segment_pages_ + this->segment_pages_ - this->cursor_;
+    }
+    // only a sealed segment (filled and no longer open) can be cleaned
+    [[nodiscard]] bool sealed(size_t segment) const { return this->segments_[segment].state == Segment::Sealed; }
+    [[nodiscard]] size_t live_pages(size_t segment) const { return this->segments_[segment].live; }
+    // number of segments sealed before this one, and so far
+    [[nodiscard]] uint64_t sealed_at(size_t segment) const { return this->segments_[segment].sealed_at; }
+    [[nodiscard]] uint64_t seals() const { return this->seals_; }
+
+   private:
+    // seal the open segment and open a free one
+    void advance();
+
+    struct Segment {
+        enum State { Free, Open, Sealed };
+        State state{Free};
+        size_t live{0};
+        uint64_t sealed_at{0};
+    };
+    const size_t segment_pages_;
+    std::vector<Segment> segments_;
+    std::vector<size_t> free_;
+    size_t open_{0};
+    size_t cursor_{0};  // next page of the open segment
+    uint64_t seals_{0};
+};
+
 #endif  // CDCACHE_BLOCKMANAGER_H
@@ -0,0 +1,66 @@
+#ifndef CDCACHE_RELOCATION_TABLE_H
+#define CDCACHE_RELOCATION_TABLE_H
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+
+#include "cacheline_index.h"
+#include "utils.h"
+
+/**
+ * Where a block went after the cacheline storing it was evicted: (old cacheline, comp fp) -> new cacheline.
+ * Lazy reference repair keeps the stale external addresses of the referencing cachelines on the device and resolves
+ * them through this table, an entry is dropped once every holder of a stale address has been rewritten or evicted.
+ * A block that moves again forms a chain, which is followed to its end.
+ */
+class RelocationTable {
+    struct Key {
+        cacheline_id_t from;
+        fp_t fp;
+        friend bool operator==(const Key &lhs, const Key &rhs) { return lhs.from == rhs.from && lhs.fp == rhs.fp; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            uint64_t h = k.fp ^ (k.from * 0x9e3779b97f4a7c15ULL);
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdULL;
+            h ^= h >> 33;
+            return h;
+        }
+    };
+
+    struct Entry {
+        cacheline_id_t to;
+        size_t holders;  // cachelines whose resolution passes through this entry
+    };
+
+   public:
+    // block `fp` of the evicted cacheline `from` now lives in `to`, `holders` cachelines still point at `from`
+    void relocate(cacheline_id_t from, fp_t fp, cacheline_id_t to, size_t holders) {
+        if (holders == 0) return;
+        auto res = this->table_.emplace(Key{from, fp}, Entry{to, holders});
+        Assert(res.second, "Block cfp=%zu of cacheline cid=%zu was relocated twice", fp, from);
+    }
+
+    // Current location of block `fp` referenced through `from`, `from` itself if it was never relocated.
+    // With `release` the caller persists (or drops) the repaired address, so it no longer holds the entries passed.
+    cacheline_id_t resolve(cacheline_id_t from, fp_t fp, bool release) {
+        while (true) {
+            auto it = this->table_.find(Key{from, fp});
+            if (it == this->table_.end()) return from;
+            from = it->second.to;
+            if (release && --it->second.holders == 0) this->table_.erase(it);
+        }
+    }
+
+    [[nodiscard]] bool empty() const { return this->table_.empty(); }
+
+    [[nodiscard]] size_t size() const { return this->table_.size(); }
+
+   private:
+    std::unordered_map<Key, Entry, KeyHash> table_;
+};
+
+#endif  // CDCACHE_RELOCATION_TABLE_H
@@ -2,15 +2,35 @@
 #define CDCACHE_SSD_PROXY_H
 
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <map>
+#include <string>
 
 #include "cacheline_index.h"
 #include "data_block.h"
 #include "device.h"
+#include "page_buffer.h"
 #include "page_manager.h"
+#include "relocation_table.h"
 #include "utils.h"
 
+// Bytes of one compressed block inside a buffer owned by someone else (a data block, a page buffer or a command)
+struct BlockView {
+    const byte_t *data{nullptr};
+    size_t len{0};
+
+    BlockView() = default;
+    BlockView(const byte_t *data, size_t len) : data(data), len(len) {}
+    BlockView(const std::vector<byte_t> &bytes) : data(bytes.data()), len(bytes.size()) {}  // NOLINT
+
+    [[nodiscard]] inline size_t size() const { return this->len; }
+    [[nodiscard]] std::vector<byte_t> toVector() const { return {this->data, this->data + this->len}; }
+    friend bool operator==(const BlockView &lhs, const BlockView &rhs) {
+        return lhs.len == rhs.len && (lhs.len == 0 || memcmp(lhs.data, rhs.data, lhs.len) == 0);
+    }
+};
+
 struct ModifyCommand {
     enum Action { Append, ModifyRef };
     Action action;
@@ -27,10 +47,10 @@ struct ModifyCommand {
         }
     }
 
-    static ModifyCommand appendCmd(const std::vector<byte_t> &data, fp_t fp) {
+    static ModifyCommand appendCmd(BlockView data, fp_t fp) {
         ModifyCommand command;
         command.fp = fp;
-        command.data = data;
+        command.data = data.toVector();
         command.action = Action::Append;
         command.new_external_addr = -1;
         return command;
@@ -95,15 +115,23 @@ struct Cacheline {
     CachelineHeader header;
     std::vector<CachelineDataBlockInfo> data_blocks_info;
     std::vector<CachelineDataLayout> data_layout;
-    std::vector<std::vector<byte_t>> data_blocks_data;
+    // views into `buffer` for a cache line read from the device, into the sources of the blocks otherwise
+    std::vector<BlockView> data_blocks_data;
+    PageBuffer buffer;
 
     static size_t get_estimate_metadata_len();
 
+    // the data blocks must outlive the cache line
     static Cacheline fromDataBlocks(const std::vector<DataBlock> &data_blocks);
 
-    size_t serialize(std::ostream &s) const;
+    // Write the on-device image into `out` padded with zeros to whole pages, return the unpadded length
+    size_t serialize(PageBuffer &out, size_t page_size) const;
+
+    // Write the header, block infos and layout to `out`, return their length
+    size_t serializeMetadata(byte_t *out) const;
 
-    void deserialize(std::istream &s, bool metadata_only);
+    // Parse the image in `buffer` in place, the data blocks are not copied out
+    void deserialize(bool metadata_only);
 
     [[nodiscard]] inline size_t size() const { return this->header.total_len(); }
     void dumpToLogger() const;
@@ -132,38 +160,164 @@ class SSDProxy {
     // Write a cache line to the cache device and return whether the write is successful.
     bool writeCacheline(Cacheline &cacheline, CachelineIndexData &data);
 
-    // modify a cacheline in device (used when eviction)
-    bool modifyCacheline(const std::vector<ModifyCommand> &commands, CachelineIndexData &data);
+    // modify a cacheline in device (used when eviction), return the number of pages written
+    size_t modifyCacheline(const std::vector<ModifyCommand> &commands, CachelineIndexData &data);
 
     // bool readDataBlocks(std::vector<DataBlock> &data_blocks, const CachelineIndexData &data);
 
     // Read cache line from cache device based on metadata
     bool readCacheline(Cacheline &cacheline, const CachelineIndexData &data);
 
-    // Read cache line metadata from cache device based on metadata
+    // Read only the pages holding the header, block infos and layout of a cache line, `data_blocks_data` stays empty
     bool readMetadataOnly(Cacheline &cachline, const CachelineIndexData &data);
 
+    // Compressed data of block `fp` stored in the cache line behind `data`, or in the shared block store if `data` is
+    // null. Only the metadata and the pages spanning the block are read, the view is valid until the next call.
+    BlockView readBlock(fp_t fp, const CachelineIndexData *data);
+
+    // Start reading the whole cache line behind `data`, or shared block `fp` if `data` is null, into `buffer` and return
+    // without waiting. The reads submitted before are waited for first, as `buffer` may be the one they read into.
+    void submitRead(fp_t fp, const CachelineIndexData *data, PageBuffer &buffer);
+
     inline AbstractPageManager *allocation_manager() { return manager_; }
 
     // Cache device free space
     size_t free_blocks() { return this->manager_->free_blocks(); }
 
-    // remove a cacheline from device
-    void removeCacheline(std::pair<addr_t, CachelineIndexData> &cur, std::map<addr_t, CachelineIndexData> &refs,
-                         std::map<fp_t, addr_t> &moved);
+    // Cache device size in pages
+    size_t total_blocks() const { return this->manager_->total_blocks(); }
+
+    // Rewrite a cache line without the stored blocks `live` rejects, `dropped` returns the comp fps no longer stored in
+    // it. Return the number of pages freed, nothing is rewritten if no page would be freed.
+    size_t compactCacheline(CachelineIndexData &data, const std::function<bool(fp_t)> &live, std::vector<fp_t> &dropped);
+
+    // Copy block `fp` out of the cache line storing it into the shared block store, the owner holds the first reference
+    void shareBlock(fp_t fp, const CachelineIndexData &owner);
+
+    void retainSharedBlock(fp_t fp);
+
+    // Drop a reference to a shared block, return true if it was the last one and the block is gone
+    bool releaseSharedBlock(fp_t fp);
+
+    // remove a batch of cachelines from device, the metadata behind `refs` is modified in place
+    void removeCachelines(const CachelineRefList &victims, CachelineRefList &refs, std::map<fp_t, addr_t> &moved);
+
+    // Log-structured layout: the sealed segment with the best LFS cost-benefit (1 - u) * age / (1 + u) of its live
+    // fraction u, age counted in segments sealed since. SIZE_MAX if there is none or the layout is not log-structured.
+    size_t segmentToReclaim(double &utilization) const;
+
+    // Move the live cachelines of a sealed segment to the open segment so it becomes free, `find` returns the metadata
+    // of a cacheline still in the index. Return false if there is no free segment to move them to, or if the padding
+    // of the moved cachelines ate up what was freed.
+    bool cleanSegment(size_t segment, const std::function<CachelineIndexData *(cacheline_id_t)> &find);
+
+    // The live cachelines of a sealed segment, sorted by id. Shared blocks stored in it are moved out right away, so
+    // the segment is free once the cachelines are removed.
+    void segmentCachelines(size_t segment, const std::function<CachelineIndexData *(cacheline_id_t)> &find,
+                           CachelineRefList &owners);
+
+    // Warm restart (Config::warm_restart) ------------------------------------------------------------------------------
+    // Wait until everything written so far is on the device
+    void sync();
+
+    // Read the metadata of the cache lines in parallel, `metadata[i]` belongs to lines[i] and has no data blocks.
+    // Return the number of pages read.
+    size_t scanMetadata(const std::vector<const CachelineIndexData *> &lines, std::vector<Cacheline> &metadata);
+
+    // Call `f` with the comp fp, compressed length, reference count and pages of every shared block
+    void forEachSharedBlock(
+        const std::function<void(fp_t, uint32_t, uint32_t, const std::vector<addr_t> &)> &f) const;
+
+    void restoreSharedBlock(fp_t fp, uint32_t len, uint32_t refs, const std::vector<addr_t> &pages);
+
+    // Take the pages of the restored cache lines (`used`) and shared blocks from the allocator
+    void restoreAllocation(const std::vector<addr_t> &used);
 
    private:
-    bool write_allocated_page(addr_t address, const byte_t *data);
-    bool read_allocated_page(addr_t address, std::vector<byte_t> &data);
+    // Transfer the pages from/to consecutive memory, pages contiguous on the device go in a single I/O
+    bool write_allocated_pages(const std::vector<addr_t> &pages, const byte_t *data);
+    bool read_allocated_pages(const std::vector<addr_t> &pages, byte_t *data);
+    // Like read_allocated_pages, but `data` is only filled once the device has completed the reads (waitReads)
+    void submit_allocated_pages(const std::vector<addr_t> &pages, byte_t *data);
+
+    // Read a cache line as it is stored on the device, without repairing its references
+    bool loadCacheline(Cacheline &cacheline, const CachelineIndexData &data, bool metadata_only = false);
+
+    // The two halves of loadCacheline: start reading the pages into the buffer of `cacheline` and return their number,
+    // then parse it once the device has completed the reads
+    size_t submitLoad(Cacheline &cacheline, const CachelineIndexData &data, bool metadata_only);
+    bool parseLoad(Cacheline &cacheline, bool metadata_only);
+
+    // Write back a cache line modified after a metadata-only load, see modifyCacheline
+    size_t patchCacheline(Cacheline &cacheline, size_t old_len, CachelineIndexData &data);
+
+    // Point the external references of `cacheline` at the current location of their blocks. With `release` the
+    // repaired cache line is about to be written back or dropped, so it stops holding relocation entries.
+    void repairRefs(Cacheline &cacheline, bool release);
 
     bool open_device(const std::string &name, size_t size);
 
+    // Log-structured layout: write the buffered segment to the device
+    void flushSegment();
+
+    // Log-structured layout: remember who owns the pages just written to the open segment
+    void recordOwner(const std::vector<addr_t> &pages, cacheline_id_t owner, fp_t fp);
+
+    // Copy the pages (of one cacheline or shared block) to the open segment and free the old ones
+    void relocatePages(std::vector<addr_t> &pages, cacheline_id_t owner, fp_t fp);
+
+    struct SegmentEntry;
+    // Call `fn` with every owner still stored in the segment and its pages
+    void forEachOwner(size_t segment, const std::function<CachelineIndexData *(cacheline_id_t)> &find,
+                      const std::function<void(const SegmentEntry &, std::vector<addr_t> &)> &fn);
+
    private:
     AbstractPageManager *manager_{nullptr};  // page allocation
     AbstractBlockDevice *device_;            // device
+    const std::string name_;                 // file behind the device
+
+    // Lazy reference repair (Config::cache_policy.evict_repair): eviction records where a block moved instead of
+    // rewriting every cache line that references it
+    const bool lazy_repair_;
+    RelocationTable relocations_;
+
+    // Shared block store (Config::dedup_layout): a block referenced by more than one cache line gets its own pages
+    struct SharedBlock {
+        uint32_t len;
+        uint32_t refs;
+        std::vector<addr_t> pages;
+    };
+    std::unordered_map<fp_t, SharedBlock> shared_blocks_;
 
     // The basic unit of page allocation
     const size_t PG_SZ{512};
+
+    // Reused across calls so the write path and the rewrites during eviction/cleaning do not allocate per cache line
+    PageBuffer write_buffer_;
+    Cacheline scratch_;
+    std::vector<WriteRun> write_runs_;
+    std::vector<ReadRun> read_runs_;
+    std::vector<addr_t> metadata_pages_;  // leading pages of a cache line read by a metadata-only load
+    PageBuffer block_buffer_;             // pages spanning the block returned by readBlock
+    std::vector<addr_t> tail_pages_;      // pages written by patchCacheline after the metadata
+    // victims read by removeCachelines, and whether only their metadata was read
+    std::vector<Cacheline> victim_cachelines_;
+    std::vector<bool> victim_metadata_only_;
+
+    // Log-structured layout (Config::device_layout): `manager_` appends to the open segment, which is kept in memory
+    // and written with one sequential I/O once the next segment is opened. Each segment keeps a summary of the
+    // cachelines (or shared blocks) written to it, entries whose owner has moved on are skipped by the cleaner.
+    SegmentPageManager *segments_{nullptr};
+    struct SegmentEntry {
+        cacheline_id_t owner;  // SHARED_STORE_ID for a shared block
+        fp_t fp;               // comp fp of a shared block
+        addr_t first;          // first page
+    };
+    std::vector<std::vector<SegmentEntry>> segment_summary_;
+    std::vector<SegmentEntry> cleaning_;  // summary of the segment being reclaimed
+    PageBuffer segment_buffer_;
+    size_t buffered_segment_{SIZE_MAX};
+    size_t buffered_pages_{0};
 };
 
 #endif  // CDCACHE_SSD_PROXY_H
@@ -4,30 +4,147 @@
 
 #include "config.h"
 
-CachelineIndex::CachelineIndex() { this->policy_ = Env::policyInstance<cacheline_id_t>(); }
-std::pair<cacheline_id_t, CachelineIndexData> CachelineIndex::fetchOldestCacheline() {
-    auto oldests = this->policy_->oldests(5);
+CachelineIndex::CachelineIndex()
+    : evict_window_(std::max<size_t>(1, globalEnv().c.cache_policy.evict_window)),
+      scored_(globalEnv().c.cache_policy.evict_mode == "scored"),
+      gc_threshold_(globalEnv().c.cache_policy.gc_threshold) {
+    Assert(this->scored_ || globalEnv().c.cache_policy.evict_mode == "refs", "Unknown evict mode %s",
+           globalEnv().c.cache_policy.evict_mode.c_str());
+    this->policy_ = Env::policyInstance<cacheline_id_t>();
+}
+
+void CachelineIndex::fetchOldestCachelines(size_t n, CachelineRefList &victims) {
+    victims.clear();
+    n = std::max<size_t>(1, n);
+    // a batch larger than half of the window widens it, so a batch is always picked from at least 2n candidates
+    const auto window = std::max(this->evict_window_, 2 * n);
+    if (this->window_.size() < n || this->window_.size() <= window / 2) {
+        this->refillEvictWindow(window);
+    }
+    Assert(!this->window_.empty(), "No cacheline can be evicted");
+    if (this->scored_) return this->fetchCheapestCachelines(n, victims);
+
+    while (victims.size() < n && !this->window_.empty()) {
+        auto [refs, id] = *this->window_.begin();
+        auto it = this->data_.find(id);
+        Assert(it != this->data_.end(), "Inconsistent data between cache line index and cache policy");
+        // refs of a candidate may grow while it waits in the window (ModifyRef during eviction), re-key it lazily
+        auto cur = it->second.external_refs_.size();
+        if (cur != refs) {
+            this->window_.erase(this->window_.begin());
+            this->window_.emplace(cur, id);
+            this->window_refs_[id].refs = cur;
+            continue;
+        }
+        globalEnv().s.evict_refs += refs;
+        this->leaveEvictWindow(id);
+        victims.emplace_back(id, &it->second);
+    }
+}
 
-    int MIN_REF = 1000000;
-    cacheline_id_t oldest{static_cast<cacheline_id_t>(-1)};
-    for (auto id : oldests) {
+void CachelineIndex::refillEvictWindow(size_t window) {
+    this->window_.clear();
+    this->window_refs_.clear();
+    this->window_width_ = window;
+    size_t rank = 0;
+    for (auto id : this->policy_->oldests(window)) {
         auto it = this->data_.find(id);
-        if (it != this->data_.end() && MIN_REF > it->second.external_refs_.size()) {
-            MIN_REF = it->second.external_refs_.size();
-            oldest = id;
+        if (it != this->data_.end()) {
+            auto refs = it->second.external_refs_.size();
+            this->window_.emplace(refs, id);
+            this->window_refs_[id] = {refs, rank++};
+        }
+    }
+}
+
+/**
+ * Every term is normalized to [0, 1] and a larger value means a more expensive victim:
+ *  - age: rank in eviction order inside the window, 0 for the oldest candidate
+ *  - migration: bytes that must be appended to a referencing cacheline, relative to the bytes stored here
+ *  - live: share of the stored bytes an LBA or the fp index still points to, the rest is dead data freed for nothing
+ *  - refs: referencing cachelines still in the cache relative to the largest fan-in of the window, each of them is
+ *    rewritten by the eviction
+ */
+size_t CachelineIndex::evictFanIn(const CachelineIndexData &data) const {
+    size_t fan_in = 0;
+    for (auto user : data.external_refs_) {
+        fan_in += this->data_.count(user);
+    }
+    return fan_in;
+}
+
+double CachelineIndex::evictCost(const CachelineIndexData &data, size_t rank, size_t fan_in, size_t max_fan_in,
+                                 size_t &migration_bytes) const {
+    migration_bytes = 0;
+    for (const auto &kv : data.block_refs_) {
+        for (auto user : kv.second.users) {
+            if (this->data_.count(user)) {
+                migration_bytes += kv.second.len;
+                break;
+            }
         }
     }
+    const double age = static_cast<double>(rank) / static_cast<double>(std::max<size_t>(1, this->window_width_ - 1));
+    const double migration =
+        static_cast<double>(migration_bytes) / static_cast<double>(std::max<size_t>(1, data.data_bytes_));
+    const double live = data.data_bytes_ > 0 ? static_cast<double>(std::min(data.live_bytes_, data.data_bytes_)) /
+                                                   static_cast<double>(data.data_bytes_)
+                                             : 0.0;
+    const double refs = max_fan_in > 0 ? static_cast<double>(fan_in) / static_cast<double>(max_fan_in) : 0.0;
 
-    auto it = this->data_.find(oldest);
-    Assert(it != this->data_.end(), "Inconsistent data between cache line index and cache policy");
-    globalEnv().s.evict_refs += it->second.external_refs_.size();
+    const auto &p = globalEnv().c.cache_policy;
+    return p.weight_age * age + p.weight_migration * migration + p.weight_live * live + p.weight_refs * refs;
+}
+
+void CachelineIndex::fetchCheapestCachelines(size_t n, CachelineRefList &victims) {
+    auto &candidates = this->scored_candidates_;
+    candidates.clear();
+    size_t max_fan_in = 0;
+    for (const auto &kv : this->window_refs_) {
+        auto it = this->data_.find(kv.first);
+        Assert(it != this->data_.end(), "Inconsistent data between cache line index and cache policy");
+        ScoredCandidate c{0, 0, this->evictFanIn(it->second), kv.first, &it->second};
+        max_fan_in = std::max(max_fan_in, c.fan_in);
+        candidates.push_back(c);
+    }
+    for (auto &c : candidates) {
+        c.cost = this->evictCost(*c.data, this->window_refs_[c.id].rank, c.fan_in, max_fan_in, c.migration_bytes);
+    }
+    n = std::min(n, candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + static_cast<std::ptrdiff_t>(n), candidates.end(),
+                      [](const auto &lhs, const auto &rhs) {
+                          return lhs.cost < rhs.cost || (lhs.cost == rhs.cost && lhs.id < rhs.id);
+                      });
+    auto &s = globalEnv().s;
+    const auto &p = globalEnv().c.cache_policy;
+    for (size_t i = 0; i < n; i++) {
+        const auto &c = candidates[i];
+        s.evict_refs += c.data->external_refs_.size();
+        s.evict_scored++;
+        s.evict_cost += c.cost;
+        s.evict_cost_max = std::max(s.evict_cost_max, c.cost);
+        const double weights = p.weight_age + p.weight_migration + p.weight_live + p.weight_refs;
+        const double share = weights > 0 ? c.cost / weights : 0.0;
+        s.evict_cost_hist[std::min(Stat::EVICT_COST_BUCKETS - 1,
+                                   static_cast<size_t>(std::max(0.0, share) * Stat::EVICT_COST_BUCKETS))]++;
+        s.evict_predicted_migration_bytes += c.migration_bytes;
+        this->leaveEvictWindow(c.id);
+        victims.emplace_back(c.id, c.data);
+    }
+}
 
-    return {oldest, it->second};
+void CachelineIndex::leaveEvictWindow(cacheline_id_t id) {
+    auto it = this->window_refs_.find(id);
+    if (it == this->window_refs_.end()) return;
+    this->window_.erase({it->second.refs, id});
+    this->window_refs_.erase(it);
 }
 
 void CachelineIndex::remove(cacheline_id_t id) {
+    this->leaveEvictWindow(id);
     this->policy_->evict(id);
     this->data_.erase(id);
+    this->cleanable_.erase(id);
 }
 
 bool CachelineIndex::query(cacheline_id_t id, CachelineIndexData &data, bool promote) {
@@ -37,20 +154,94 @@ bool CachelineIndex::query(cacheline_id_t id, CachelineIndexData &data, bool pro
     } else {
         data = it->second;
         if (promote) {
+            this->leaveEvictWindow(id);
             this->policy_->promote(id);
         }
         return true;
     }
 }
+CachelineIndexData *CachelineIndex::find(cacheline_id_t id, bool promote) {
+    auto it = this->data_.find(id);
+    if (it == this->data_.end()) {
+        return nullptr;
+    }
+    if (promote) {
+        this->leaveEvictWindow(id);
+        this->policy_->promote(id);
+    }
+    return &it->second;
+}
+
+void CachelineIndex::collectRefs(const CachelineRefList &victims, CachelineRefList &refs) {
+    refs.clear();
+    auto is_victim = [&victims](cacheline_id_t id) {
+        return std::any_of(victims.begin(), victims.end(), [id](const auto &v) { return v.first == id; });
+    };
+    for (const auto &victim : victims) {
+        for (auto ref_id : victim.second->external_refs_) {
+            if (is_victim(ref_id)) continue;
+            auto it = this->data_.find(ref_id);
+            if (it != this->data_.end()) {
+                refs.emplace_back(ref_id, &it->second);
+            }
+        }
+    }
+    std::sort(refs.begin(), refs.end(), [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+    // a cacheline may reference several victims
+    refs.erase(std::unique(refs.begin(), refs.end(),
+                           [](const auto &lhs, const auto &rhs) { return lhs.first == rhs.first; }),
+               refs.end());
+}
+
+namespace {
+    // live fraction of a cacheline that cleaning could shrink, 1 if it can not
+    double cleanableUtilization(const CachelineIndexData &data) {
+        // a single page can not shrink
+        if (data.allocation_pages_.size() < 2 || data.data_bytes_ == 0) return 1;
+        return static_cast<double>(std::min(data.live_bytes_, data.data_bytes_)) /
+               static_cast<double>(data.data_bytes_);
+    }
+}  // namespace
+
+void CachelineIndex::updateUtilization(cacheline_id_t id, const CachelineIndexData &data) {
+    if (this->gc_threshold_ > 0 && cleanableUtilization(data) < this->gc_threshold_) this->cleanable_.insert(id);
+}
+
+void CachelineIndex::cleaningCandidates(cacheline_id_t now, size_t n, std::vector<cacheline_id_t> &candidates) {
+    auto &scored = this->cleaning_scores_;
+    scored.clear();
+    for (auto it = this->cleanable_.begin(); it != this->cleanable_.end();) {
+        const auto data = this->data_.find(*it);
+        const double u = data == this->data_.end() ? 1 : cleanableUtilization(data->second);
+        if (u >= this->gc_threshold_) {
+            it = this->cleanable_.erase(it);
+            continue;
+        }
+        const double age = static_cast<double>(now - std::min(now, *it) + 1);
+        scored.emplace_back((1 - u) * age / (1 + u), *it);
+        ++it;
+    }
+    n = std::min(n, scored.size());
+    std::partial_sort(scored.begin(), scored.begin() + static_cast<std::ptrdiff_t>(n), scored.end(),
+                      [](const auto &lhs, const auto &rhs) { return lhs > rhs; });
+    candidates.clear();
+    for (size_t i = n; i > 0; i--) {
+        candidates.push_back(scored[i - 1].second);
+    }
+}
+
 void CachelineIndex::insert(cacheline_id_t id, const CachelineIndexData &data, bool promote) {
     this->data_[id] = data;
-    this->policy_->insert(id);
     if (promote) {
-        this->policy_->promote(id);
+        this->leaveEvictWindow(id);
+        this->policy_->admit(id);
+    } else {
+        this->policy_->insert(id);
     }
 }
 
-void CachelineIndex::addRefToCacheline(cacheline_id_t id, cacheline_id_t ref, bool promote) {
+void CachelineIndex::addRefToCacheline(cacheline_id_t id, cacheline_id_t ref, fp_t comp_fp, uint32_t len,
+                                       bool promote) {
     // CachelineIndexData idx;
     // this->query(id, idx, promote);
     // idx.external_refs_.insert(ref);
@@ -58,5 +249,24 @@ void CachelineIndex::addRefToCacheline(cacheline_id_t id, cacheline_id_t ref, bo
     auto it = this->data_.find(id);
     if (it == this->data_.end()) return;
     it->second.external_refs_.insert(ref);
+    auto &block = it->second.block_refs_[comp_fp];
+    block.len = len;
+    if (block.users.empty() || block.users.back() != ref) block.users.push_back(ref);
+    this->leaveEvictWindow(id);
     this->policy_->promote(id);
 }
+
+void CachelineIndex::evictionOrder(std::vector<cacheline_id_t> &ids) const {
+    ids.clear();
+    std::unordered_set<cacheline_id_t> seen;
+    for (auto id : this->policy_->oldests(this->data_.size())) {
+        if (this->data_.count(id) && seen.insert(id).second) ids.push_back(id);
+    }
+    if (ids.size() == this->data_.size()) return;
+    // the policy could not name all of them, the rest follow in the order they were written
+    const auto first = ids.size();
+    for (const auto &kv : this->data_) {
+        if (!seen.count(kv.first)) ids.push_back(kv.first);
+    }
+    std::sort(ids.begin() + static_cast<std::ptrdiff_t>(first), ids.end());
+}
@@ -19,4 +19,7 @@ bool SimpleFPIndex::remove(fp_t fp) {
     return false;
 }
 size_t SimpleFPIndex::size() { return this->table_.size(); }
-SimpleFPIndex::~SimpleFPIndex() = default;
\ No newline at end of file
+void SimpleFPIndex::forEach(const std::function<void(fp_t, const FPIndexData &)> &f) {
+    for (auto &kv : this->table_) f(kv.first, kv.second);
+}
+SimpleFPIndex::~SimpleFPIndex() = default;
\ No newline at end of file
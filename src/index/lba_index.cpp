@@ -22,3 +22,7 @@ bool SimpleLBAIndex::remove(addr_t address) {
     this->table_.erase(address);
     return true;
 }
+
+void SimpleLBAIndex::forEach(const std::function<void(addr_t, fp_t)> &f) {
+    for (auto &kv : this->table_) f(kv.first, kv.second);
+}
@@ -1,12 +1,28 @@
 #include "page_manager.h"
 
+#include <algorithm>
+#include <iterator>
+
+#include "config.h"
+
+void AbstractPageManager::recordAllocation(const std::vector<addr_t> &blocks, size_t first, bool split) {
+    auto &s = globalEnv().s;
+    s.alloc_requests++;
+    s.alloc_split_requests += split;
+    for (size_t i = first; i < blocks.size(); i++) {
+        s.alloc_extents += i == first || blocks[i] != blocks[i - 1] + 1;
+    }
+}
+
 bool StackedDiscretePageManager::allocate(size_t len, std::vector<addr_t> &blocks) {
     if (this->free_blocks_ < len) return false;
+    const auto first = blocks.size();
     for (int i = 0; i < len; i++) {
         addr_t addr;
         Assert(this->allocate_one(addr), "Allocation Failure");
         blocks.push_back(addr);
     }
+    recordAllocation(blocks, first, false);
     return true;
 }
 bool StackedDiscretePageManager::reclaim(addr_t addr) {
@@ -33,4 +49,155 @@ bool StackedDiscretePageManager::allocate_one(addr_t &addr) {
     return false;
 }
 
-size_t StackedDiscretePageManager::free_blocks() { return this->free_blocks_; }
\ No newline at end of file
+size_t StackedDiscretePageManager::free_blocks() { return this->free_blocks_; }
+
+ExtentPageManager::ExtentPageManager(size_t size) : AbstractPageManager(size), free_blocks_(size) {
+    fprintf(stderr, "Allocator: total %zu blocks in extents\n", size);
+    if (size > 0) this->insert_extent(0, size);
+    this->updateStat();
+}
+
+bool ExtentPageManager::allocate(size_t len, std::vector<addr_t> &blocks) {
+    if (this->free_blocks_ < len) return false;
+    if (len == 0) return true;
+    const auto first = blocks.size();
+    auto fit = this->by_size_.lower_bound({len, 0});
+    const bool split = fit == this->by_size_.end();
+    if (!split) {
+        this->take(fit->second, len, blocks);
+    } else {
+        // the free space is too fragmented for one extent, take the longest ones
+        for (size_t left = len; left > 0;) {
+            const auto longest = *std::prev(this->by_size_.end());
+            const auto n = std::min(left, longest.first);
+            this->take(longest.second, n, blocks);
+            left -= n;
+        }
+    }
+    recordAllocation(blocks, first, split);
+    this->updateStat();
+    return true;
+}
+
+bool ExtentPageManager::reclaim(addr_t addr) {
+    Assert(addr < this->size_, "Invalid Block address %zu", addr);
+    addr_t begin = addr;
+    size_t len = 1;
+    auto next = this->by_addr_.upper_bound(addr);
+    if (next != this->by_addr_.begin()) {
+        auto prev = std::prev(next);
+        Assert(prev->first + prev->second <= addr, "Try reclaim an un-allocated block");
+        if (prev->first + prev->second == addr) {
+            begin = prev->first;
+            len += prev->second;
+            this->erase_extent(prev);
+        }
+    }
+    if (next != this->by_addr_.end() && next->first == addr + 1) {
+        len += next->second;
+        this->erase_extent(next);
+    }
+    this->insert_extent(begin, len);
+    ++this->free_blocks_;
+    this->updateStat();
+    return true;
+}
+
+size_t ExtentPageManager::free_blocks() { return this->free_blocks_; }
+
+void ExtentPageManager::take(addr_t begin, size_t len, std::vector<addr_t> &blocks) {
+    auto it = this->by_addr_.find(begin);
+    Assert(it != this->by_addr_.end() && it->second >= len, "Invalid free extent at %zu", begin);
+    const auto rest = it->second - len;
+    this->erase_extent(it);
+    if (rest > 0) this->insert_extent(begin + len, rest);
+    for (size_t i = 0; i < len; i++) {
+        blocks.push_back(begin + i);
+    }
+    this->free_blocks_ -= len;
+}
+
+void ExtentPageManager::insert_extent(addr_t begin, size_t len) {
+    this->by_addr_.emplace(begin, len);
+    this->by_size_.emplace(len, begin);
+}
+
+void ExtentPageManager::erase_extent(std::map<addr_t, size_t>::iterator it) {
+    this->by_size_.erase({it->second, it->first});
+    this->by_addr_.erase(it);
+}
+
+void ExtentPageManager::updateStat() const {
+    auto &s = globalEnv().s;
+    s.alloc_free_pages = this->free_blocks_;
+    s.alloc_free_extents = this->free_extents();
+    s.alloc_free_extents_max = std::max<uint64_t>(s.alloc_free_extents_max, s.alloc_free_extents);
+    s.alloc_largest_free_extent = this->largest_free_extent();
+}
+
+SegmentPageManager::SegmentPageManager(size_t size, size_t segment_pages)
+    : AbstractPageManager(size), segment_pages_(segment_pages), segments_(size / segment_pages) {
+    Assert(this->segments_.size() > RESERVED_SEGMENTS + 1, "The device holds only %zu segments of %zu pages",
+           this->segments_.size(), segment_pages);
+    fprintf(stderr, "Allocator: total %zu blocks in %zu segments\n", size, this->segments_.size());
+    // the lowest segments are opened first
+    for (size_t i = this->segments_.size(); i > 0; i--) {
+        this->free_.push_back(i - 1);
+    }
+    this->open_ = this->free_.back();
+    this->free_.pop_back();
+    this->segments_[this->open_].state = Segment::Open;
+}
+
+bool SegmentPageManager::allocate(size_t len, std::vector<addr_t> &blocks) {
+    Assert(len <= this->segment_pages_, "Can not allocate %zu pages in segments of %zu pages", len,
+           this->segment_pages_);
+    if (len == 0) return true;
+    if (this->cursor_ + len > this->segment_pages_) {
+        if (this->free_.empty()) return false;
+        this->advance();
+    }
+    const auto first = blocks.size();
+    const auto begin = this->open_ * this->segment_pages_ + this->cursor_;
+    for (size_t i = 0; i < len; i++) {
+        blocks.push_back(begin + i);
+    }
+    this->cursor_ += len;
+    this->segments_[this->open_].live += len;
+    recordAllocation(blocks, first, false);
+    return true;
+}
+
+bool SegmentPageManager::reclaim(addr_t addr) {
+    const auto i = this->segment_of(addr);
+    Assert(i < this->segments_.size(), "Invalid Block address %zu", addr);
+    auto &segment = this->segments_[i];
+    Assert(segment.state != Segment::Free && segment.live > 0, "Try reclaim an un-allocated block");
+    if (--segment.live == 0 && segment.state == Segment::Sealed) {
+        segment.state = Segment::Free;
+        this->free_.push_back(i);
+    }
+    return true;
+}
+
+size_t SegmentPageManager::free_blocks() {
+    const auto free = this->free_.size() > RESERVED_SEGMENTS ? this->free_.size() - RESERVED_SEGMENTS : 0;
+    return free * this->segment_pages_ + this->segment_pages_ - this->cursor_;
+}
+
+void SegmentPageManager::advance() {
+    // taken before the sealed segment may be freed, so two consecutive open segments always differ
+    const auto next = this->free_.back();
+    this->free_.pop_back();
+    auto &sealed = this->segments_[this->open_];
+    globalEnv().s.segment_padding_pages += this->segment_pages_ - this->cursor_;
+    sealed.sealed_at = this->seals_++;
+    sealed.state = Segment::Sealed;
+    if (sealed.live == 0) {
+        sealed.state = Segment::Free;
+        this->free_.push_back(this->open_);
+    }
+    this->open_ = next;
+    this->segments_[this->open_].state = Segment::Open;
+    this->cursor_ = 0;
+}
\ No newline at end of file
@@ -1,12 +1,12 @@
 #include "ssd_proxy.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <map>
 #include <set>
-#include <sstream>
+#include <thread>
 
 #include "config.h"
 
@@ -15,6 +15,27 @@ namespace {
         auto res = bytes / block_size;
         return bytes % block_size == 0 ? res : res + 1;
     }
+
+    // refs is sorted by cacheline id
+    CachelineIndexData *find_ref(CachelineRefList &refs, cacheline_id_t id) {
+        auto it = std::lower_bound(refs.begin(), refs.end(), id,
+                                   [](const auto &ref, cacheline_id_t v) { return ref.first < v; });
+        return it != refs.end() && it->first == id ? it->second : nullptr;
+    }
+
+    // One run per range of pages contiguous on the device, page i of `pages` is at buf + page_size * i
+    template <typename Byte>
+    void coalesce_pages(const std::vector<addr_t> &pages, Byte *buf, size_t page_size, std::vector<IoRun<Byte>> &runs) {
+        runs.clear();
+        for (size_t i = 0; i < pages.size(); i++) {
+            const uint64_t addr = pages[i] * page_size;
+            if (!runs.empty() && runs.back().addr + runs.back().len == addr) {
+                runs.back().len += page_size;
+            } else {
+                runs.push_back({addr, buf + page_size * i, static_cast<uint32_t>(page_size)});
+            }
+        }
+    }
 }  // namespace
 
 // Assemble multiple data blocks into cacheline
@@ -67,13 +88,8 @@ bool SSDProxy::writeDataBlocks(std::vector<DataBlock> &data_blocks, CachelineInd
 }
 
 bool SSDProxy::writeCacheline(Cacheline &cacheline, CachelineIndexData &data) {
-    std::stringstream s;
-    cacheline.serialize(s);
-    auto bytes = s.str();
-    // Add padding zeros
-    if (bytes.size() % this->PG_SZ != 0) {
-        bytes.append(this->PG_SZ - bytes.size() % this->PG_SZ, 0);
-    }
+    cacheline.serialize(this->write_buffer_, this->PG_SZ);
+    const auto &bytes = this->write_buffer_;
     if (!this->manager_->allocate(bytes.size() / this->PG_SZ, data.allocation_pages_)) {
         ERROR("[SSD write] Can not allocation enough free allocation blocks");
         return false;
@@ -83,39 +99,99 @@ bool SSDProxy::writeCacheline(Cacheline &cacheline, CachelineIndexData &data) {
            vec2str(data.allocation_page_).c_str());
 
     Assert(bytes.size() == data.allocation_pages_.size() * this->PG_SZ, "[SSD write] Invalid bytes len");
-    for (int i = 0; i < data.allocation_pages_.size(); i++) {
-        this->write_allocated_page(data.allocation_pages_[i],
-                                   reinterpret_cast<const byte_t *>(bytes.data() + this->PG_SZ * i));
-    }
+    data.data_bytes_ = cacheline.header.data_blocks_data_len;
+    this->write_allocated_pages(data.allocation_pages_, bytes.data());
+    this->recordOwner(data.allocation_pages_, data.id_, 0);
     return true;
 }
 bool SSDProxy::open_device(const std::string &name, size_t size) { return this->device_->open(name.c_str(), size); }
 
-SSDProxy::SSDProxy(const std::string &name, size_t size) : PG_SZ(512 * globalEnv().c.page_granularity) {
-    this->device_ = new MemBlockDevice();
+SSDProxy::SSDProxy(const std::string &name, size_t size)
+    : name_(name),
+      lazy_repair_(globalEnv().c.cache_policy.evict_repair == "lazy"),
+      PG_SZ(512 * globalEnv().c.page_granularity) {
+    Assert(this->lazy_repair_ || globalEnv().c.cache_policy.evict_repair == "eager", "Unknown evict repair mode %s",
+           globalEnv().c.cache_policy.evict_repair.c_str());
+    const auto &device = globalEnv().c.cache_device;
+    if (device == "file") {
+        this->device_ = new FileBlockDevice();
+    } else if (device == "uring") {
+        this->device_ = new UringBlockDevice(globalEnv().c.io_queue_depth);
+    } else {
+        Assert(device == "mem", "Unknown cache device %s", device.c_str());
+        this->device_ = new MemBlockDevice();
+    }
     Assert(this->open_device(name, size), "Can not open SSD device %s", name.c_str());
-    this->manager_ = new StackedDiscretePageManager(this->device_->size() / this->PG_SZ);
+    const auto &allocator = globalEnv().c.page_allocator;
+    const auto &layout = globalEnv().c.device_layout;
+    Assert(layout == "page" || layout == "log", "Unknown device layout %s", layout.c_str());
+    if (layout == "log") {
+        // an evicted cacheline must not be rewritten to keep blocks other cachelines use, that needs a whole new copy
+        // in the log while its old pages stay until the segment is reclaimed
+        Assert(globalEnv().c.dedup_layout == "shared", "The log device layout needs the shared dedup layout");
+        const auto segment_pages = globalEnv().c.segment_size / this->PG_SZ;
+        Assert(segment_pages > 0 && globalEnv().c.segment_size % this->PG_SZ == 0,
+               "Segment size %zu is not a multiple of the page size", globalEnv().c.segment_size);
+        // at most a quarter of a segment is lost to padding, so a cleaned segment frees space
+        const auto cacheline_bytes = Cacheline::get_estimate_metadata_len() +
+                                     globalEnv().c.dataset_block_size * globalEnv().c.data_block_buffer_size;
+        const auto cacheline_pages = get_block_need(cacheline_bytes, this->PG_SZ);
+        Assert(segment_pages >= 4 * cacheline_pages,
+               "A segment of %zu pages must hold at least 4 cachelines of %zu pages", segment_pages, cacheline_pages);
+        this->segments_ = new SegmentPageManager(this->device_->size() / this->PG_SZ, segment_pages);
+        this->manager_ = this->segments_;
+        this->segment_summary_.resize(this->segments_->segments());
+        this->segment_buffer_.resize(segment_pages * this->PG_SZ);
+    } else if (allocator == "extent") {
+        this->manager_ = new ExtentPageManager(this->device_->size() / this->PG_SZ);
+    } else {
+        Assert(allocator == "stacked", "Unknown page allocator %s", allocator.c_str());
+        this->manager_ = new StackedDiscretePageManager(this->device_->size() / this->PG_SZ);
+    }
     Assert(this->manager_, "Can not init block allocation manager");
 }
 
-bool SSDProxy::write_allocated_page(addr_t address, const byte_t *data) {
-    for (int i = 0; i < globalEnv().c.page_granularity; i++) {
-        Assert(this->device_->write((address * globalEnv().c.page_granularity + i) * 512, data + 512 * i, 512) == 512,
-               "Can not write data to SSD");
+bool SSDProxy::write_allocated_pages(const std::vector<addr_t> &pages, const byte_t *data) {
+    if (this->segments_) {
+        // the pages are consecutive in the open segment, which is only written once it is sealed
+        const auto segment = this->segments_->segment_of(pages.front());
+        if (segment != this->buffered_segment_) {
+            this->flushSegment();
+            this->buffered_segment_ = segment;
+            this->segment_summary_[segment].clear();
+        }
+        const auto offset = pages.front() - segment * this->segments_->segment_pages();
+        Assert(pages.back() == pages.front() + pages.size() - 1 &&
+                   offset + pages.size() <= this->segments_->segment_pages(),
+               "Pages are not consecutive in one segment");
+        memcpy(this->segment_buffer_.data() + offset * this->PG_SZ, data, pages.size() * this->PG_SZ);
+        this->buffered_pages_ = std::max(this->buffered_pages_, offset + pages.size());
+        return true;
     }
+    coalesce_pages(pages, data, this->PG_SZ, this->write_runs_);
+    Assert(this->device_->writev(this->write_runs_) == pages.size() * this->PG_SZ, "Can not write data to SSD");
+    globalEnv().s.device_write_ios += this->write_runs_.size();
     return true;
 }
 
-bool SSDProxy::read_allocated_page(addr_t address, std::vector<byte_t> &data) {
-    data = std::vector<byte_t>(this->PG_SZ, 0);
+bool SSDProxy::read_allocated_pages(const std::vector<addr_t> &pages, byte_t *data) {
+    this->submit_allocated_pages(pages, data);
+    this->device_->waitReads();
+    return true;
+}
+
+void SSDProxy::submit_allocated_pages(const std::vector<addr_t> &pages, byte_t *data) {
     //    LOGGER("READ allocation block address: %d", address);
-    for (int i = 0; i < globalEnv().c.page_granularity; i++) {
-        Assert(this->device_->read((address * globalEnv().c.page_granularity + i) * 512, data.data() + 512 * i, 512) ==
-                   512,
-               "Can not read cacheline data from SSD");
+    if (this->segments_ && this->segments_->segment_of(pages.front()) == this->buffered_segment_) {
+        const auto offset = pages.front() - this->buffered_segment_ * this->segments_->segment_pages();
+        memcpy(data, this->segment_buffer_.data() + offset * this->PG_SZ, pages.size() * this->PG_SZ);
+        return;
     }
-
-    return true;
+    coalesce_pages(pages, data, this->PG_SZ, this->read_runs_);
+    Assert(this->device_->submitReads(this->read_runs_) == pages.size() * this->PG_SZ,
+           "Can not read cacheline data from SSD");
+    globalEnv().s.device_read_ios += this->read_runs_.size();
+    globalEnv().s.device_read_pages += pages.size();
 }
 
 // bool SSDProxy::readDataBlocks(std::vector<DataBlock> &data_blocks, const CachelineIndexData &data) {
@@ -137,21 +213,36 @@ bool SSDProxy::read_allocated_page(addr_t address, std::vector<byte_t> &data) {
 //     return true;
 // }
 bool SSDProxy::readCacheline(Cacheline &cacheline, const CachelineIndexData &data) {
-    std::stringstream s;
-    auto &address = data.allocation_pages_;
-    Assert(!address.empty(), "[SSD READ] Empty block address list when read cacheline");
-    size_t sz = 0;
-    for (auto addr : address) {
-        std::vector<byte_t> temp_buffer;
-        this->read_allocated_page(addr, temp_buffer);
-        sz += temp_buffer.size();
-        s.write(reinterpret_cast<const char *>(temp_buffer.data()), static_cast<std::streamsize>(temp_buffer.size()));
+    if (!this->loadCacheline(cacheline, data)) return false;
+    this->repairRefs(cacheline, false);
+    return true;
+}
+
+bool SSDProxy::loadCacheline(Cacheline &cacheline, const CachelineIndexData &data, bool metadata_only) {
+    this->submitLoad(cacheline, data, metadata_only);
+    this->device_->waitReads();
+    return this->parseLoad(cacheline, metadata_only);
+}
+
+size_t SSDProxy::submitLoad(Cacheline &cacheline, const CachelineIndexData &data, bool metadata_only) {
+    const auto *address = &data.allocation_pages_;
+    Assert(!address->empty(), "[SSD READ] Empty block address list when read cacheline");
+    if (metadata_only) {
+        // the metadata has a fixed size (the entries are padded to data_block_buffer_size) and comes first
+        const auto n = std::min(address->size(), get_block_need(Cacheline::get_estimate_metadata_len(), this->PG_SZ));
+        this->metadata_pages_.assign(address->begin(), address->begin() + static_cast<std::ptrdiff_t>(n));
+        address = &this->metadata_pages_;
     }
+    // the pages are read straight into the buffer the cache line is parsed from
+    this->submit_allocated_pages(*address, cacheline.buffer.resize(address->size() * this->PG_SZ));
 
     //  LOGGER("[SSD READ] blocks=[%s], %zu bytes data was read", vec2str(address).c_str(), sz);
+    return address->size();
+}
 
+bool SSDProxy::parseLoad(Cacheline &cacheline, bool metadata_only) {
     try {
-        cacheline.deserialize(s, false);
+        cacheline.deserialize(metadata_only);
         return true;
     } catch (std::exception &e) {
         ERROR("Can not deserialize cacheline, cause: %s", e.what());
@@ -159,81 +250,247 @@ bool SSDProxy::readCacheline(Cacheline &cacheline, const CachelineIndexData &dat
     }
 }
 
+void SSDProxy::repairRefs(Cacheline &cacheline, bool release) {
+    if (this->relocations_.empty()) return;
+    // several entries of one cache line may reference the same block, they hold the relocation entries once
+    std::map<fp_t, addr_t> repaired;
+    for (auto &info : cacheline.data_blocks_info) {
+        if (info.type != 0) continue;
+        auto it = repaired.find(info.comp_fp);
+        if (it == repaired.end()) {
+            auto to = this->relocations_.resolve(info.external_address, info.comp_fp, release);
+            it = repaired.emplace(info.comp_fp, to).first;
+            if (release && to != info.external_address) globalEnv().s.relocation_repaired++;
+        }
+        info.external_address = it->second;
+    }
+}
+
 bool SSDProxy::readMetadataOnly(Cacheline &cachline, const CachelineIndexData &data) {
-    // TODO: Need optimization
-    this->readCacheline(cachline, data);
-    //    std::stringstream s;
-    //    std::vector<byte_t> first_block;
-    //    LOGGER("First address is %zu", data.allocation_page_[0]);
-    //
-    //    this->read_allocated_page(data.allocation_page_[0], first_block);
-    //    s.write(reinterpret_cast<const char *>(first_block.data()), static_cast<std::streamsize>(first_block.size()));
-    //    s.read(reinterpret_cast<char *>(&cachline.header), sizeof(CachelineHeader));
-    //    // 先读取第一个block,获取metadata长度
-    //    auto metadata_len = cachline.header.header_len + cachline.header.data_layout_len +
-    //    cachline.header.data_blocks_info_len;
-    //
-    //    auto total_blocks_needed = metadata_len / (this->PG_SZ);
-    //    if (metadata_len % this->PG_SZ != 0) total_blocks_needed += 1;
-    //    LOGGER("metadata len is %zu //// blocks needed is %zu", metadata_len, total_blocks_needed);
-    //    // 已经读取一个了，接下来还刷要total_blocks_needed - 1个
-    //    for (int i = 0; i < total_blocks_needed - 1; i++) {
-    //        std::vector<byte_t> temp_buffer;
-    //        this->read_allocated_page(data.allocation_page_[i + 1], first_block);
-    //        s.write(reinterpret_cast<const char *>(temp_buffer.data()),
-    //        static_cast<std::streamsize>(temp_buffer.size()));
-    //    }
-    //    LOGGER("Total %zu bytes was read", s.tellp());
-    //    cachline.deserialize(s, true);
+    if (!this->loadCacheline(cachline, data, true)) return false;
+    this->repairRefs(cachline, false);
+    return true;
+}
+
+BlockView SSDProxy::readBlock(fp_t fp, const CachelineIndexData *data) {
+    auto &buffer = this->block_buffer_;
+    if (!data) {
+        auto it = this->shared_blocks_.find(fp);
+        Assert(it != this->shared_blocks_.end(), "Block cfp=%zu is not in the shared block store", fp);
+        auto &pages = it->second.pages;
+        this->read_allocated_pages(pages, buffer.resize(pages.size() * this->PG_SZ));
+        return {buffer.data(), it->second.len};
+    }
+    auto &cacheline = this->scratch_;
+    Assert(this->loadCacheline(cacheline, *data, true), "Can not read the metadata of the cacheline storing cfp=%zu",
+           fp);
+    auto info = std::find_if(cacheline.data_blocks_info.begin(), cacheline.data_blocks_info.end(),
+                             [fp](const auto &i) { return i.comp_fp == fp && i.type == 1; });
+    Assert(info != cacheline.data_blocks_info.end(), "Can not find data of cfp=%zu in its cacheline", fp);
+    const auto &layout = cacheline.data_layout[info->pos_index];
+    const auto &header = cacheline.header;
+    // the data region follows the metadata, a layout offset is relative to it
+    const size_t begin = header.header_len + header.data_blocks_info_len + header.data_layout_len + layout.offset;
+    const auto first = begin / this->PG_SZ;
+    const auto last = (begin + layout.len - 1) / this->PG_SZ;
+    Assert(layout.len > 0 && last < data->allocation_pages_.size(), "Block cfp=%zu exceeds its cacheline", fp);
+    const auto &address = data->allocation_pages_;
+    this->metadata_pages_.assign(address.begin() + static_cast<std::ptrdiff_t>(first),
+                                 address.begin() + static_cast<std::ptrdiff_t>(last + 1));
+    this->read_allocated_pages(this->metadata_pages_, buffer.resize(this->metadata_pages_.size() * this->PG_SZ));
+    return {buffer.data() + (begin - first * this->PG_SZ), layout.len};
+}
+
+void SSDProxy::submitRead(fp_t fp, const CachelineIndexData *data, PageBuffer &buffer) {
+    this->device_->waitReads();
+    const std::vector<addr_t> *pages = nullptr;
+    if (data) {
+        pages = &data->allocation_pages_;
+    } else {
+        auto it = this->shared_blocks_.find(fp);
+        Assert(it != this->shared_blocks_.end(), "Block cfp=%zu is not in the shared block store", fp);
+        pages = &it->second.pages;
+    }
+    this->submit_allocated_pages(*pages, buffer.resize(pages->size() * this->PG_SZ));
+}
+
+size_t SSDProxy::compactCacheline(CachelineIndexData &data, const std::function<bool(fp_t)> &live,
+                                  std::vector<fp_t> &dropped) {
+    dropped.clear();
+    auto &cacheline = this->scratch_;
+    this->loadCacheline(cacheline, data);
+
+    // Copy the data of the live blocks forward. A second copy of a kept block only keeps its metadata (type 2) like
+    // modifyCacheline does. The number of entries is fixed, so a dropped block stays as a reference without data,
+    // pointing at the shared store if the block lives on there.
+    Cacheline compacted;
+    compacted.header = cacheline.header;
+    std::unordered_map<fp_t, bool> stored;  // comp fp -> kept
+    uint32_t data_len = 0;
+    for (auto info : cacheline.data_blocks_info) {
+        if (info.type == 0) {
+            compacted.data_blocks_info.push_back(info);
+            continue;
+        }
+        auto it = stored.find(info.comp_fp);
+        if (it == stored.end()) {
+            it = stored.emplace(info.comp_fp, info.type == 1 && live(info.comp_fp)).first;
+            if (it->second) {
+                const auto bytes = cacheline.data_blocks_data[info.pos_index];
+                info.pos_index = compacted.data_layout.size();
+                compacted.data_layout.push_back({data_len, static_cast<uint32_t>(bytes.size())});
+                compacted.data_blocks_data.push_back(bytes);
+                data_len += bytes.size();
+                compacted.data_blocks_info.push_back(info);
+                continue;
+            }
+            dropped.push_back(info.comp_fp);
+        }
+        info.pos_index = -1;
+        if (it->second) {
+            info.type = 2;
+        } else {
+            info.type = 0;
+            info.external_address = this->shared_blocks_.count(info.comp_fp) ? SHARED_STORE_ID : -1;
+        }
+        compacted.data_blocks_info.push_back(info);
+    }
+
+    const auto n = compacted.data_blocks_info.size();
+    compacted.data_layout.resize(n, {static_cast<uint32_t>(-1), static_cast<uint32_t>(-1)});
+    compacted.header.data_blocks_info_len = sizeof(CachelineDataBlockInfo) * n;
+    compacted.header.data_layout_len = sizeof(CachelineDataLayout) * n;
+    compacted.header.data_blocks_data_len = data_len;
+    compacted.header.data_blocks_number = n;
+    const auto pages = get_block_need(compacted.size(), this->PG_SZ);
+    if (pages >= data.allocation_pages_.size()) {
+        dropped.clear();
+        return 0;
+    }
+
+    this->repairRefs(compacted, true);  // written back below
+    const auto freed = data.allocation_pages_.size() - pages;
+    for (auto addr : data.allocation_pages_) {
+        this->manager_->reclaim(addr);
+    }
+    data.allocation_pages_.clear();
+    this->writeCacheline(compacted, data);
+    auto &s = globalEnv().s;
+    s.gc_compactions++;
+    s.gc_page_write += data.allocation_pages_.size();
+    s.gc_pages_freed += freed;
+    s.gc_bytes_dropped += cacheline.header.data_blocks_data_len - data_len;
+    return freed;
+}
+
+void SSDProxy::shareBlock(fp_t fp, const CachelineIndexData &owner) {
+    const auto view = this->readBlock(fp, &owner);
+
+    auto res = this->shared_blocks_.emplace(fp, SharedBlock{static_cast<uint32_t>(view.size()), 1, {}});
+    Assert(res.second, "Block cfp=%zu is already shared", fp);
+    auto &block = res.first->second;
+    auto &bytes = this->write_buffer_;
+    auto *dst = bytes.resize(get_block_need(view.size(), this->PG_SZ) * this->PG_SZ);
+    memcpy(dst, view.data, view.size());
+    memset(dst + view.size(), 0, bytes.size() - view.size());
+    Assert(this->manager_->allocate(bytes.size() / this->PG_SZ, block.pages),
+           "[SSD write] Can not allocation enough free allocation blocks for shared block");
+    this->write_allocated_pages(block.pages, bytes.data());
+    this->recordOwner(block.pages, SHARED_STORE_ID, fp);
+
+    auto &s = globalEnv().s;
+    s.shared_promotions++;
+    s.shared_page_write += block.pages.size();
+    s.shared_pages += block.pages.size();
+    s.shared_bytes += block.len;
+    s.shared_pages_max = std::max(s.shared_pages_max, s.shared_pages);
+}
+
+void SSDProxy::retainSharedBlock(fp_t fp) {
+    auto it = this->shared_blocks_.find(fp);
+    Assert(it != this->shared_blocks_.end(), "Block cfp=%zu is not shared", fp);
+    it->second.refs++;
+}
+
+bool SSDProxy::releaseSharedBlock(fp_t fp) {
+    auto it = this->shared_blocks_.find(fp);
+    Assert(it != this->shared_blocks_.end(), "Block cfp=%zu is not shared", fp);
+    if (--it->second.refs > 0) return false;
+    for (auto addr : it->second.pages) {
+        this->manager_->reclaim(addr);
+    }
+    globalEnv().s.shared_pages -= it->second.pages.size();
+    globalEnv().s.shared_bytes -= it->second.len;
+    this->shared_blocks_.erase(it);
     return true;
 }
 
 /**
  * dirty code below
- * @param cur Information about the cache line that is about to be deleted  <cacheline id -> cacheline metadata> (from
- * the cache line index)
- * @param refs All cache line metadata referencing the current cache line <cacheline id -> cacheline metadata>
+ * @param victims IDs and metadata (from the cache line index) of the cache lines that are about to be deleted together
+ * @param refs Handles to all other cache line metadata referencing the victims, modified in place
  * @param moved Information about modified data blocks
             key: data block compress fingerprint
             value: The cache line ID where the data block is located after remove operation finished.
-            If it is equal to the deleted cache line ID, it means that it has been actually deleted.
-            If it is not equal to the deleted cache line ID, it means that it has been moved to another cache line.
+            If it is equal to one of the deleted cache line IDs, it means that it has been actually deleted.
+            If it is not, it means that it has been moved to another cache line.
+ * The modifications of all victims are merged per referencing cache line, so each of them is rewritten only once.
+ * With lazy repair only the cache lines that receive a block are rewritten, the other references are redirected by
+ * relocation entries and repaired the next time their cache line is rewritten.
  */
-void SSDProxy::removeCacheline(std::pair<addr_t, CachelineIndexData> &cur, std::map<addr_t, CachelineIndexData> &refs,
-                               std::map<fp_t, addr_t> &moved) {
-    // read out curent cache line
-    Cacheline cur_cacheline;
-    LOGGER("Try remove cacheline %zu", cur.first);
-    this->readCacheline(cur_cacheline, cur.second);
-    // 要被逐出的cacheline的data_block表，key是comp_fp,value是它在data区域的位置，方便确定要逐出的cacheline真的引用了当前的cacheline
-    // data block location in deleted cacheline
-    std::unordered_map<fp_t, size_t> stored_data_blocks;
-    for (auto &ch : cur_cacheline.data_blocks_info) {
-        if (ch.type == 1) {
-            Assert(ch.pos_index != -1, "Invalid Pos index");
-            stored_data_blocks[ch.comp_fp] = ch.pos_index;
+void SSDProxy::removeCachelines(const CachelineRefList &victims, CachelineRefList &refs,
+                                std::map<fp_t, addr_t> &moved) {
+    // read out the victims
+    // only grown, so the page buffers of the victims are allocated once
+    auto &victim_cachelines = this->victim_cachelines_;
+    if (victim_cachelines.size() < victims.size()) victim_cachelines.resize(victims.size());
+    auto &metadata_only = this->victim_metadata_only_;
+    metadata_only.assign(victims.size(), false);
+    // 要被逐出的cacheline的data_block表，key是comp_fp,value是(victim下标, 它在data区域的位置)
+    // data block location in the deleted cachelines
+    std::unordered_map<fp_t, std::pair<size_t, size_t>> stored_data_blocks;
+    for (size_t v = 0; v < victims.size(); v++) {
+        LOGGER("Try remove cacheline %zu", victims[v].first);
+        auto &cur_cacheline = victim_cachelines[v];
+        // the data is only needed for blocks that are moved to a cache line staying in the cache
+        bool needs_data = false;
+        for (const auto &kv : victims[v].second->block_refs_) {
+            for (auto user : kv.second.users) needs_data = needs_data || find_ref(refs, user) != nullptr;
+        }
+        metadata_only[v] = !needs_data;
+        // the reads of all victims are in flight together
+        globalEnv().s.evict_page_read += this->submitLoad(cur_cacheline, *victims[v].second, !needs_data);
+        if (!needs_data) globalEnv().s.evict_metadata_reads++;
+    }
+    this->device_->waitReads();
+    for (size_t v = 0; v < victims.size(); v++) {
+        auto &cur_cacheline = victim_cachelines[v];
+        this->parseLoad(cur_cacheline, metadata_only[v]);
+        this->repairRefs(cur_cacheline, true);
+        for (auto &ch : cur_cacheline.data_blocks_info) {
+            // Initialize `moved` table, a block stored in a victim keeps the victim that stores it
+            if (ch.type == 1) {
+                Assert(ch.pos_index != -1, "Invalid Pos index");
+                stored_data_blocks[ch.comp_fp] = {v, ch.pos_index};
+                moved[ch.comp_fp] = victims[v].first;
+            } else {
+                moved.emplace(ch.comp_fp, victims[v].first);
+            }
+        }
+        // Recycle the cache line contents (the cache line is already in memory)
+        for (auto addr : victims[v].second->allocation_pages_) {
+            this->manager_->reclaim(addr);
         }
-        // Initialize `moved` table
-        moved[ch.comp_fp] = cur.first;
     }
 
     // 如果需要删除的cacheline没有任何引用，直接移除即可
     // empty refs: return
     if (refs.empty()) {
-        // reclaim all pages
-        for (auto addr : cur.second.allocation_pages_) {
-            this->manager_->reclaim(addr);
-        }
         return;
     }
 
     //============================The following is the case when the reference is not empty=============================
 
-    // Recycle the cache line contents (the cache line is already in memory)
-    for (auto addr : cur.second.allocation_pages_) {
-        this->manager_->reclaim(addr);
-    }
-
     // 这里可能会出现各种相互引用和多个之间引用的情况，因此处理必须很小心
     // key ==> data_block指纹 value ==> 被引用的id
     // 这个表表示引用了data_block 哈希为key的所有cacheline的信息
@@ -256,25 +513,24 @@ void SSDProxy::removeCacheline(std::pair<addr_t, CachelineIndexData> &cur, std::
     // Key: The data block ID where the reference appears
     // Value : Information about all cache lines that reference this data block
     std::unordered_map<fp_t, std::set<ChooseInfo>> ref_table;
-    for (auto &ref : refs) {
-        // 遍历每个引用当前cacheline的cacheline并读出引用的cacheline的metadata
-        // Check the metadata of all cache lines that reference the deleted cache line
-        Cacheline external_cacheline;
-        this->readMetadataOnly(external_cacheline, ref.second);
-        for (auto &ch : external_cacheline.data_blocks_info) {       // traverse all data blocks
-            if (ch.type == 0 && ch.external_address == cur.first) {  // the data block refers to deleted cacheline
-                Assert(stored_data_blocks.count(ch.comp_fp) > 0, "Can not find ref data_block when modify refs");
-                // 添加到被引用表
-                // ref_table[ch.comp_fp].push_back(ref.first);
+    // The reverse reference graph kept in memory tells which blocks are referenced by whom, so the metadata of the
+    // referencing cache lines does not need to be read from the device. `refs` does not contain the victims, so a
+    // victim referencing another victim is skipped here.
+    for (const auto &victim : victims) {
+        for (auto &kv : victim.second->block_refs_) {
+            Assert(stored_data_blocks.count(kv.first) > 0, "Can not find ref data_block when modify refs");
+            for (auto user : kv.second.users) {
+                auto user_data = find_ref(refs, user);
+                if (!user_data) continue;  // the user has already been evicted or is evicted together
                 // add to reference table
-                ChooseInfo info{ref.second.time_stamp_, ref.first};
-                ref_table[ch.comp_fp].insert(info);
+                ref_table[kv.first].insert({user_data->time_stamp_, user});
             }
         }
     }
 
     // Modifications required for each referenced cache line
     std::map<addr_t, std::vector<ModifyCommand>> commands_map;
+    std::set<addr_t> redirected;  // lazy repair: cache lines whose references are only redirected
     for (auto &kv : ref_table) {
         // for debug
         std::string s;
@@ -292,7 +548,8 @@ void SSDProxy::removeCacheline(std::pair<addr_t, CachelineIndexData> &cur, std::
         auto i = stored_data_blocks.find(kv.first);
         Assert(i != stored_data_blocks.end(), "Can not find data in cur cacheline");
         // Picks the first cache line from the reference table and appends the current data block to that cache line
-        auto appendCmd = ModifyCommand::appendCmd(cur_cacheline.data_blocks_data[i->second], kv.first);
+        const auto block_data = victim_cachelines[i->second.first].data_blocks_data[i->second.second];
+        auto appendCmd = ModifyCommand::appendCmd(block_data, kv.first);
 
         // 更新指向的cacheline(更新后的表示kv.first实际上指向的data_block只是修改了位置，没有删除)
         // update data block location
@@ -301,12 +558,33 @@ void SSDProxy::removeCacheline(std::pair<addr_t, CachelineIndexData> &cur, std::
         // 剩下的引用当前数据即可
         // For other cache lines that reference the current data block, just modify the reference.
         it++;
+        auto head_data = find_ref(refs, head_cacheline.cacheline_id);
+        Assert(head_data, "Invalid Ref Cacheline id");
+        auto &head_block = head_data->block_refs_[kv.first];
+        head_block.len = static_cast<uint32_t>(appendCmd.data.size());
+        globalEnv().s.evict_migrated_bytes += appendCmd.data.size();
         while (it != kv.second.end()) {
-            refs[head_cacheline.cacheline_id].external_refs_.insert(it->cacheline_id);
-            auto modifyCmd = ModifyCommand::modifyCmd(kv.first, head_cacheline.cacheline_id);
-            commands_map[it->cacheline_id].push_back(modifyCmd);
+            head_data->external_refs_.insert(it->cacheline_id);
+            head_block.users.push_back(it->cacheline_id);
+            if (this->lazy_repair_) {
+                redirected.insert(it->cacheline_id);
+            } else {
+                auto modifyCmd = ModifyCommand::modifyCmd(kv.first, head_cacheline.cacheline_id);
+                commands_map[it->cacheline_id].push_back(modifyCmd);
+            }
             ++it;
         }
+        // every user, the head included, still points at the victim on the device
+        if (this->lazy_repair_) {
+            this->relocations_.relocate(victims[i->second.first].first, kv.first, head_cacheline.cacheline_id,
+                                        kv.second.size());
+            globalEnv().s.relocation_entries++;
+            globalEnv().s.relocation_entries_max =
+                std::max<uint64_t>(globalEnv().s.relocation_entries_max, this->relocations_.size());
+        }
+    }
+    for (auto id : redirected) {
+        globalEnv().s.relocation_deferred_rewrites += commands_map.count(id) == 0;
     }
 
     // for debug
@@ -320,17 +598,12 @@ void SSDProxy::removeCacheline(std::pair<addr_t, CachelineIndexData> &cur, std::
     // apply commands to eache cacheline
     for (auto &kv : commands_map) {
         // 遍历每个命令并开始执行
-        auto it = refs.find(kv.first);
-        Assert(it != refs.end(), "Invalid Ref Cacheline id");
-        // 修改data
-        auto data = it->second;
-        auto addr1 = data.allocation_pages_.front();
-        LOGGER("Modify cacheline cid=%zu", it->first);
-
-        this->modifyCacheline(kv.second, data);
-        auto addr2 = data.allocation_pages_.front();
-        // 因为这里会append一些block，会修改地址，因此cacheline index也要更新，这也是为什么const 不传引用的原因
-        refs[kv.first] = data;
+        auto data = find_ref(refs, kv.first);
+        Assert(data, "Invalid Ref Cacheline id");
+        LOGGER("Modify cacheline cid=%zu", kv.first);
+        // 因为这里会append一些block，会修改地址，直接修改cacheline index中的元数据
+        globalEnv().s.evict_page_write += this->modifyCacheline(kv.second, *data);
+        globalEnv().s.evict_rewrites++;
     }
 }
 
@@ -340,10 +613,15 @@ void SSDProxy::removeCacheline(std::pair<addr_t, CachelineIndexData> &cur, std::
  * @param data Modified cache line metadata
  * @return
  */
-bool SSDProxy::modifyCacheline(const std::vector<ModifyCommand> &commands, CachelineIndexData &data) {
+size_t SSDProxy::modifyCacheline(const std::vector<ModifyCommand> &commands, CachelineIndexData &data) {
     // TODO 根据commands内提供的信息修改一个cacheline
-    Cacheline cacheline;
-    this->readCacheline(cacheline, data);
+    auto &cacheline = this->scratch_;
+    // The stored data never moves and appended blocks go after it, so only the metadata and the appended data are
+    // needed. A log-structured device can not update pages in place and rewrites the whole cache line.
+    const bool in_place = this->segments_ == nullptr;
+    this->loadCacheline(cacheline, data, in_place);
+    this->repairRefs(cacheline, true);  // the cache line is written back, pending relocations are persisted
+    const auto old_len = cacheline.size();
     std::map<fp_t, std::vector<size_t>> infos;
     // data_blocks info里面是元数据位置
     // 这里可能有两个相同的data_block引用了同一个
@@ -392,7 +670,8 @@ bool SSDProxy::modifyCacheline(const std::vector<ModifyCommand> &commands, Cache
         }
     }
 
-    // 回收之前的,然后重新写入整个cacheline,这里全部读出修改然后写入，其实可以继续优化（只读出一部分，但是过于麻烦1）
+    if (in_place) return this->patchCacheline(cacheline, old_len, data);
+    // 回收之前的,然后重新写入整个cacheline
     for (auto addr : data.allocation_pages_) {
         this->manager_->reclaim(addr);
     }
@@ -401,9 +680,229 @@ bool SSDProxy::modifyCacheline(const std::vector<ModifyCommand> &commands, Cache
     // cacheline.dumpToLogger();
     this->writeCacheline(cacheline, data);
     // LOGGER("Re alloc blocks for current cacheline with new size: %d", data.allocation_page_.size());
-    return true;
+    return data.allocation_pages_.size();
+}
+
+/**
+ * `cacheline` holds the metadata pages as read by a metadata-only load, with the metadata already modified, and the
+ * appended blocks in `data_blocks_data`. The metadata pages are overwritten, the appended data is written from the
+ * page the old data ends in (read back unless it is a metadata page) to the new pages allocated after it.
+ */
+size_t SSDProxy::patchCacheline(Cacheline &cacheline, size_t old_len, CachelineIndexData &data) {
+    auto &pages = data.allocation_pages_;
+    auto &head = this->metadata_pages_;  // the pages read by the load
+    auto *meta = cacheline.buffer.data();
+    cacheline.serializeMetadata(meta);
+    const auto new_len = cacheline.size();
+    auto &tail = this->tail_pages_;
+    tail.clear();
+    if (new_len > old_len) {
+        const auto first = old_len / this->PG_SZ;
+        const auto total = get_block_need(new_len, this->PG_SZ);
+        Assert(total == pages.size() || this->manager_->allocate(total - pages.size(), pages),
+               "[SSD write] Can not allocation enough free allocation blocks for appended data");
+        tail.assign(pages.begin() + static_cast<std::ptrdiff_t>(first), pages.end());
+        auto *image = this->write_buffer_.resize(tail.size() * this->PG_SZ);
+        // the metadata pages from `first` on are written with the tail
+        const auto shared = head.size() > first ? head.size() - first : 0;
+        memcpy(image, meta + first * this->PG_SZ, shared * this->PG_SZ);
+        head.resize(std::min(head.size(), first));
+        if (shared == 0 && old_len % this->PG_SZ != 0) {
+            this->read_allocated_pages({tail.front()}, image);
+        }
+        auto *p = image + (old_len - first * this->PG_SZ);
+        for (const auto &block : cacheline.data_blocks_data) {
+            memcpy(p, block.data, block.size());
+            p += block.size();
+        }
+        memset(p, 0, image + this->write_buffer_.size() - p);
+        data.data_bytes_ = cacheline.header.data_blocks_data_len;
+    }
+    if (!head.empty()) this->write_allocated_pages(head, meta);
+    if (!tail.empty()) this->write_allocated_pages(tail, this->write_buffer_.data());
+    globalEnv().s.evict_patches++;
+    return head.size() + tail.size();
+}
+SSDProxy::~SSDProxy() {
+    this->flushSegment();
+    delete this->manager_;
+    delete this->device_;
+}
+
+void SSDProxy::sync() {
+    this->flushSegment();
+    this->device_->drain();
+}
+
+size_t SSDProxy::scanMetadata(const std::vector<const CachelineIndexData *> &lines, std::vector<Cacheline> &metadata) {
+    metadata.clear();
+    metadata.resize(lines.size());
+    // the workers share a device of their own, positioned reads can run concurrently on it
+    FileBlockDevice reader;
+    Assert(reader.open(this->name_.c_str(), this->device_->size()), "Can not open %s to scan it", this->name_.c_str());
+    const auto metadata_pages = get_block_need(Cacheline::get_estimate_metadata_len(), this->PG_SZ);
+    const auto workers =
+        std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), lines.size() / 256));
+    const auto chunk = (lines.size() + workers - 1) / workers;
+    std::vector<size_t> pages(workers, 0);
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+        threads.emplace_back([&, w] {
+            std::vector<addr_t> head;
+            std::vector<ReadRun> runs;
+            for (auto i = w * chunk; i < std::min(lines.size(), (w + 1) * chunk); i++) {
+                const auto &all = lines[i]->allocation_pages_;
+                head.assign(all.begin(), all.begin() + static_cast<std::ptrdiff_t>(std::min(all.size(), metadata_pages)));
+                auto &cacheline = metadata[i];
+                coalesce_pages(head, cacheline.buffer.resize(head.size() * this->PG_SZ), this->PG_SZ, runs);
+                Assert(reader.readv(runs) == head.size() * this->PG_SZ, "Can not read the metadata of cacheline cid=%zu",
+                       lines[i]->id_);
+                cacheline.deserialize(true);
+                pages[w] += head.size();
+            }
+        });
+    }
+    for (auto &t : threads) t.join();
+    size_t total = 0;
+    for (auto n : pages) total += n;
+    return total;
+}
+
+void SSDProxy::forEachSharedBlock(
+    const std::function<void(fp_t, uint32_t, uint32_t, const std::vector<addr_t> &)> &f) const {
+    for (const auto &kv : this->shared_blocks_) f(kv.first, kv.second.len, kv.second.refs, kv.second.pages);
+}
+
+void SSDProxy::restoreSharedBlock(fp_t fp, uint32_t len, uint32_t refs, const std::vector<addr_t> &pages) {
+    Assert(this->shared_blocks_.emplace(fp, SharedBlock{len, refs, pages}).second, "Block cfp=%zu is restored twice",
+           fp);
+    auto &s = globalEnv().s;
+    s.shared_pages += pages.size();
+    s.shared_bytes += len;
+    s.shared_pages_max = std::max(s.shared_pages_max, s.shared_pages);
+}
+
+void SSDProxy::restoreAllocation(const std::vector<addr_t> &used) {
+    const auto total = this->manager_->total_blocks();
+    std::vector<bool> taken(total, false);
+    auto take = [&taken, total](addr_t addr) {
+        Assert(addr < total && !taken[addr], "Page %zu is restored twice or out of the device", addr);
+        taken[addr] = true;
+    };
+    for (auto addr : used) take(addr);
+    for (const auto &kv : this->shared_blocks_) {
+        for (auto addr : kv.second.pages) take(addr);
+    }
+    // Allocate the whole device and give back the free pages, the highest first so the stacked allocator hands them
+    // out in address order. The allocation counters are left as they were.
+    auto &s = globalEnv().s;
+    const auto requests = s.alloc_requests, extents = s.alloc_extents, split = s.alloc_split_requests;
+    std::vector<addr_t> all;
+    Assert(this->manager_->allocate(total, all), "Can not take the pages of the restored cache");
+    for (auto addr = total; addr-- > 0;) {
+        if (!taken[addr]) this->manager_->reclaim(addr);
+    }
+    s.alloc_requests = requests;
+    s.alloc_extents = extents;
+    s.alloc_split_requests = split;
+}
+
+void SSDProxy::flushSegment() {
+    if (this->buffered_pages_ == 0) return;
+    const auto segment_bytes = this->segments_->segment_pages() * this->PG_SZ;
+    this->write_runs_.assign(1, {this->buffered_segment_ * segment_bytes, this->segment_buffer_.data(),
+                                 static_cast<uint32_t>(this->buffered_pages_ * this->PG_SZ)});
+    Assert(this->device_->writev(this->write_runs_) == this->buffered_pages_ * this->PG_SZ,
+           "Can not write segment to SSD");
+    auto &s = globalEnv().s;
+    s.device_write_ios++;
+    s.segment_writes++;
+    s.segment_page_write += this->buffered_pages_;
+    this->buffered_pages_ = 0;
+}
+
+void SSDProxy::recordOwner(const std::vector<addr_t> &pages, cacheline_id_t owner, fp_t fp) {
+    if (!this->segments_) return;
+    this->segment_summary_[this->buffered_segment_].push_back({owner, fp, pages.front()});
+}
+
+void SSDProxy::relocatePages(std::vector<addr_t> &pages, cacheline_id_t owner, fp_t fp) {
+    auto *buffer = this->scratch_.buffer.resize(pages.size() * this->PG_SZ);
+    this->read_allocated_pages(pages, buffer);
+    std::vector<addr_t> moved;
+    Assert(this->manager_->allocate(pages.size(), moved), "No free segment left for the cleaner");
+    this->write_allocated_pages(moved, buffer);
+    this->recordOwner(moved, owner, fp);
+    for (auto addr : pages) {
+        this->manager_->reclaim(addr);
+    }
+    pages.swap(moved);
+    globalEnv().s.segment_clean_pages += pages.size();
+}
+
+size_t SSDProxy::segmentToReclaim(double &utilization) const {
+    if (!this->segments_) return SIZE_MAX;
+    const auto capacity = static_cast<double>(this->segments_->segment_pages());
+    const auto now = this->segments_->seals();
+    size_t victim = SIZE_MAX;
+    double best = -1;
+    for (size_t i = 0; i < this->segments_->segments(); i++) {
+        if (!this->segments_->sealed(i)) continue;
+        const auto u = static_cast<double>(this->segments_->live_pages(i)) / capacity;
+        const auto benefit = (1 - u) * static_cast<double>(now - this->segments_->sealed_at(i)) / (1 + u);
+        if (benefit > best) {
+            best = benefit;
+            victim = i;
+            utilization = u;
+        }
+    }
+    return victim;
+}
+
+bool SSDProxy::cleanSegment(size_t segment, const std::function<CachelineIndexData *(cacheline_id_t)> &find) {
+    // the moved cachelines may spill over into a new segment
+    if (this->segments_->free_segments() == 0) return false;
+    const auto unused = this->segments_->unused_pages();
+    this->forEachOwner(segment, find, [this](const SegmentEntry &entry, std::vector<addr_t> &pages) {
+        this->relocatePages(pages, entry.owner, entry.fp);
+    });
+    Assert(!this->segments_->sealed(segment), "Segment %zu still has %zu live pages after cleaning", segment,
+           this->segments_->live_pages(segment));
+    globalEnv().s.segment_cleaned++;
+    return this->segments_->unused_pages() > unused;
+}
+
+void SSDProxy::segmentCachelines(size_t segment, const std::function<CachelineIndexData *(cacheline_id_t)> &find,
+                                 CachelineRefList &owners) {
+    owners.clear();
+    this->forEachOwner(segment, find, [this, &owners, &find](const SegmentEntry &entry, std::vector<addr_t> &pages) {
+        if (entry.owner == SHARED_STORE_ID) {
+            this->relocatePages(pages, entry.owner, entry.fp);
+        } else {
+            owners.emplace_back(entry.owner, find(entry.owner));
+        }
+    });
+    std::sort(owners.begin(), owners.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+}
+
+void SSDProxy::forEachOwner(size_t segment, const std::function<CachelineIndexData *(cacheline_id_t)> &find,
+                            const std::function<void(const SegmentEntry &, std::vector<addr_t> &)> &fn) {
+    // the summary of the segment is cleared once it is reopened, which may happen while `fn` moves data out of it
+    this->cleaning_.swap(this->segment_summary_[segment]);
+    this->segment_summary_[segment].clear();
+    for (const auto &entry : this->cleaning_) {
+        std::vector<addr_t> *pages = nullptr;
+        if (entry.owner == SHARED_STORE_ID) {
+            auto it = this->shared_blocks_.find(entry.fp);
+            if (it != this->shared_blocks_.end()) pages = &it->second.pages;
+        } else if (auto data = find(entry.owner)) {
+            pages = &data->allocation_pages_;
+        }
+        // the owner is gone or has been rewritten since
+        if (!pages || pages->empty() || pages->front() != entry.first) continue;
+        fn(entry, *pages);
+    }
 }
-SSDProxy::~SSDProxy() { delete this->manager_; }
 
 /**
  * 对于modifyInfo内的每个kv修改其kv.first指向的data_block的external ref为kv.second
@@ -411,54 +910,73 @@ SSDProxy::~SSDProxy() { delete this->manager_; }
  * @return
  */
 
-void Cacheline::deserialize(std::istream &s, bool metadata_only) {
-    if (!metadata_only) {
-        s.read(reinterpret_cast<char *>(&this->header), sizeof(CachelineHeader));
-        if (header.data_blocks_number != globalEnv().c.data_block_buffer_size) {
-            LOGGER("Error header data_block len %d", header.data_blocks_number);
-        }
-
-        Assert(header.data_blocks_number == globalEnv().c.data_block_buffer_size,
-               "[1] Error header data_block len (len = %d)", header.data_blocks_number);
+void Cacheline::deserialize(bool metadata_only) {
+    const auto *p = this->buffer.data();
+    const auto *end = p + this->buffer.size();
+    auto take = [&](void *dst, size_t len) {
+        Assert(p + len <= end, "Truncated cacheline: %zu bytes left but %zu needed", end - p, len);
+        memcpy(dst, p, len);
+        p += len;
+    };
+    take(&this->header, sizeof(CachelineHeader));
+    if (header.data_blocks_number != globalEnv().c.data_block_buffer_size) {
+        LOGGER("Error header data_block len %d", header.data_blocks_number);
     }
+    Assert(header.data_blocks_number == globalEnv().c.data_block_buffer_size,
+           "[1] Error header data_block len (len = %d)", header.data_blocks_number);
 
-    Assert(header.data_blocks_number == globalEnv().c.data_block_buffer_size, "[2] Error header data_block len");
-    this->data_blocks_info =
-        std::vector<CachelineDataBlockInfo>(this->header.data_blocks_number, CachelineDataBlockInfo());
-    this->data_layout = std::vector<CachelineDataLayout>(this->header.data_blocks_number, CachelineDataLayout());
-    s.read(reinterpret_cast<char *>(this->data_blocks_info.data()),
-           static_cast<std::streamsize>(sizeof(CachelineDataBlockInfo) * this->data_blocks_info.size()));
-    s.read(reinterpret_cast<char *>(this->data_layout.data()),
-           static_cast<std::streamsize>(sizeof(CachelineDataLayout) * this->data_layout.size()));
+    this->data_blocks_info.resize(this->header.data_blocks_number);
+    this->data_layout.resize(this->header.data_blocks_number);
+    take(this->data_blocks_info.data(), sizeof(CachelineDataBlockInfo) * this->data_blocks_info.size());
+    take(this->data_layout.data(), sizeof(CachelineDataLayout) * this->data_layout.size());
+    this->data_blocks_data.clear();
     if (!metadata_only) {
         for (auto &layout : this->data_layout) {
             if (layout.len == -1 && layout.offset == -1) {
                 break;
             }
-            std::vector<byte_t> bytes(layout.len, 0);
-            s.read(reinterpret_cast<char *>(bytes.data()), static_cast<std::streamsize>(layout.len));
-            this->data_blocks_data.push_back(bytes);
+            Assert(p + layout.len <= end, "Truncated cacheline data: %zu bytes left but %u needed", end - p,
+                   layout.len);
+            this->data_blocks_data.emplace_back(p, layout.len);
+            p += layout.len;
         }
     }
 }
 
-size_t Cacheline::serialize(std::ostream &s) const {
+size_t Cacheline::serialize(PageBuffer &out, size_t page_size) const {
     Assert(this->header.data_blocks_number == globalEnv().c.data_block_buffer_size,
            "Error data_block number with l = %zu", this->header.data_blocks_number);
-    s.write(reinterpret_cast<const char *>(&this->header), sizeof(CachelineHeader));
-    s.write(reinterpret_cast<const char *>(this->data_blocks_info.data()),
-            static_cast<std::streamsize>(sizeof(CachelineDataBlockInfo) * this->data_blocks_info.size()));
-    s.write(reinterpret_cast<const char *>(this->data_layout.data()),
-            static_cast<std::streamsize>(sizeof(CachelineDataLayout) * this->data_layout.size()));
+    const auto len = this->header.total_len();
+    auto *p = out.resize((len + page_size - 1) / page_size * page_size);
+    p += this->serializeMetadata(p);
+    auto put = [&](const void *src, size_t n) {
+        Assert(p + n <= out.data() + out.size(), "Cacheline data exceeds its header length %zu", len);
+        memcpy(p, src, n);
+        p += n;
+    };
     for (auto &ch : this->data_blocks_data) {
-        s.write(reinterpret_cast<const char *>(ch.data()), static_cast<std::streamsize>(ch.size()));
+        put(ch.data, ch.size());
     }
 
-    auto r = s.tellp();
-    Assert(r == this->header.total_len(), "Unexpected serialize: tellp  =  %zu but total = %zu", r, header.total_len());
+    const auto r = static_cast<size_t>(p - out.data());
+    Assert(r == len, "Unexpected serialize: %zu bytes written but total = %zu", r, len);
+    // Add padding zeros
+    memset(p, 0, out.size() - r);
     return r;
 }
 
+size_t Cacheline::serializeMetadata(byte_t *out) const {
+    auto *p = out;
+    auto put = [&](const void *src, size_t n) {
+        memcpy(p, src, n);
+        p += n;
+    };
+    put(&this->header, sizeof(CachelineHeader));
+    put(this->data_blocks_info.data(), sizeof(CachelineDataBlockInfo) * this->data_blocks_info.size());
+    put(this->data_layout.data(), sizeof(CachelineDataLayout) * this->data_layout.size());
+    return p - out;
+}
+
 size_t Cacheline::get_estimate_metadata_len() {
     return sizeof(CachelineHeader) +
            globalEnv().c.data_block_buffer_size * (sizeof(CachelineDataBlockInfo) + sizeof(CachelineDataLayout));
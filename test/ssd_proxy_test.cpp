@@ -0,0 +1,108 @@
+#include <cstring>
+#include <vector>
+
+#include "catch2/catch_amalgamated.hpp"
+#include "config.h"
+#include "ssd_proxy.h"
+
+namespace {
+    const size_t PG_SZ = 512;
+
+    std::vector<byte_t> pattern(size_t len, byte_t seed) {
+        std::vector<byte_t> bytes(len);
+        for (size_t i = 0; i < len; i++) bytes[i] = static_cast<byte_t>(seed + i * 7);
+        return bytes;
+    }
+
+    // A cache line of data_block_buffer_size entries: entry 0 stores `stored`, the others reference block i + 100 in
+    // cache line 1000 + i
+    Cacheline makeCacheline(const std::vector<byte_t> &stored) {
+        Cacheline cacheline;
+        const auto n = globalEnv().c.data_block_buffer_size;
+        for (size_t i = 0; i < n; i++) {
+            CachelineDataBlockInfo info{};
+            info.comp_fp = i + 100;
+            info.raw_fp = i + 200;
+            info.raw_len = 4096;
+            info.type = i == 0;
+            info.pos_index = i == 0 ? 0 : -1;
+            info.external_address = i == 0 ? -1 : 1000 + i;
+            cacheline.data_blocks_info.push_back(info);
+            cacheline.data_layout.push_back({static_cast<uint32_t>(-1), static_cast<uint32_t>(-1)});
+        }
+        cacheline.data_layout[0] = {0, static_cast<uint32_t>(stored.size())};
+        cacheline.data_blocks_data.emplace_back(stored);
+        cacheline.header.header_len = sizeof(CachelineHeader);
+        cacheline.header.data_blocks_info_len = sizeof(CachelineDataBlockInfo) * n;
+        cacheline.header.data_layout_len = sizeof(CachelineDataLayout) * n;
+        cacheline.header.data_blocks_data_len = stored.size();
+        cacheline.header.data_blocks_number = n;
+        return cacheline;
+    }
+
+    // Apply the commands of the round trip to the expected cache line the way modifyCacheline does
+    void append(Cacheline &cacheline, size_t entry, const std::vector<byte_t> &data) {
+        auto &info = cacheline.data_blocks_info[entry];
+        info.type = 1;
+        info.external_address = -1;
+        info.pos_index = cacheline.data_blocks_data.size();
+        cacheline.data_layout[info.pos_index] = {cacheline.header.data_blocks_data_len,
+                                                 static_cast<uint32_t>(data.size())};
+        cacheline.data_blocks_data.emplace_back(data);
+        cacheline.header.data_blocks_data_len += data.size();
+    }
+
+    // Write a cache line whose data ends at `old_len`, append a block to entry 1, move the reference of entry 2 and
+    // check the cache line read back
+    void roundTrip(size_t old_len) {
+        const auto metadata_len = Cacheline::get_estimate_metadata_len();
+        REQUIRE(old_len > metadata_len);
+        SSDProxy proxy("ssd_proxy_test", 1024 * PG_SZ);
+        const auto stored = pattern(old_len - metadata_len, 1);
+        auto cacheline = makeCacheline(stored);
+        CachelineIndexData data;
+        data.id_ = 1;
+        REQUIRE(proxy.writeCacheline(cacheline, data));
+        REQUIRE(data.allocation_pages_.size() == (old_len + PG_SZ - 1) / PG_SZ);
+
+        const auto appended = pattern(PG_SZ + 100, 3);
+        const auto pages = proxy.modifyCacheline(
+            {ModifyCommand::appendCmd(appended, 101), ModifyCommand::modifyCmd(102, 2000)}, data);
+        auto expected = makeCacheline(stored);
+        append(expected, 1, appended);
+        expected.data_blocks_info[2].external_address = 2000;
+        const auto new_len = expected.size();
+        REQUIRE(data.allocation_pages_.size() == (new_len + PG_SZ - 1) / PG_SZ);
+        REQUIRE(data.data_bytes_ == stored.size() + appended.size());
+        // the metadata pages before the page the old data ends in, then everything from that page on
+        const auto metadata_pages = (metadata_len + PG_SZ - 1) / PG_SZ;
+        const auto first = old_len / PG_SZ;
+        REQUIRE(pages == std::min(metadata_pages, first) + data.allocation_pages_.size() - first);
+
+        Cacheline actual;
+        REQUIRE(proxy.readCacheline(actual, data));
+        REQUIRE(actual == expected);
+
+        // a reference change alone only rewrites the metadata pages
+        REQUIRE(proxy.modifyCacheline({ModifyCommand::modifyCmd(103, 3000)}, data) == metadata_pages);
+        expected.data_blocks_info[3].external_address = 3000;
+        REQUIRE(proxy.readCacheline(actual, data));
+        REQUIRE(actual == expected);
+    }
+}  // namespace
+
+TEST_CASE("Patch a cache line whose data ends inside the metadata pages", "[ssd_proxy]") {
+    const auto metadata_len = Cacheline::get_estimate_metadata_len();
+    REQUIRE(metadata_len % PG_SZ < PG_SZ - 16);
+    roundTrip(metadata_len + 16);
+}
+
+TEST_CASE("Patch a cache line whose data ends on a page boundary", "[ssd_proxy]") {
+    const auto metadata_pages = (Cacheline::get_estimate_metadata_len() + PG_SZ - 1) / PG_SZ;
+    roundTrip((metadata_pages + 1) * PG_SZ);
+}
+
+TEST_CASE("Patch a cache line whose data ends in the middle of a data page", "[ssd_proxy]") {
+    const auto metadata_pages = (Cacheline::get_estimate_metadata_len() + PG_SZ - 1) / PG_SZ;
+    roundTrip((metadata_pages + 1) * PG_SZ + 200);
+}